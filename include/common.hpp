@@ -32,4 +32,9 @@ const u64 kClockRate = 4'194'304;      // Classic Gameboy
 const u64 kSuperClockRate = 4'295'454; // Super Gameboy
 const u64 kColorClockRate = 8'388'608; // Gameboy Color
 
+enum class Model : u8 {
+  DMG, // Classic Gameboy
+  SGB  // Super Gameboy
+};
+
 #endif /* !COMMON_H */
@@ -10,6 +10,7 @@
 
 #include <iomanip>
 #include <sstream>
+#include <vector>
 
 #include "common.hpp"
 #include "registers.hpp"
@@ -44,12 +45,66 @@ public:
 
   /**
    * Run fetch-decode-execute cycle
+   *
+   * Returns 0 without executing when pc is at a breakpoint or the previous
+   * instruction hit a watchpoint, the following call resumes from it.
    */
   ticks_t cycle();
 
+  /**
+   * Run fetch-decode-execute cycle ignoring breakpoints
+   */
+  ticks_t step();
+
+  /**
+   * Stop execution before the instruction at address is fetched
+   *
+   * Returns false if a breakpoint was already set at address.
+   */
+  bool addBreakpoint(addr_t a);
+
+  /**
+   * Remove breakpoint, returns false if there was none at address
+   */
+  bool removeBreakpoint(addr_t a);
+
+  const std::vector<addr_t> &breakpoints() const;
+
+  /**
+   * Whether last cycle stopped at a breakpoint
+   */
+  bool stopped() const;
+
+  /**
+   * Whether last stop was caused by a watchpoint
+   */
+  bool watched() const;
+
+  /**
+   * Forget the last stop, next cycle checks breakpoints again
+   */
+  void clearStop();
+
 private:
   std::vector<ticks_t (Cpu::*)()> iset_;
 
+  // Sorted, never part of the fetch window so that checking for them only
+  // happens when the window is missed.
+  std::vector<addr_t> breakpoints_;
+  bool stopped_;
+  bool watched_;
+
+  // Instruction fetch window, host memory of the region pc lives in
+  const u8 *fetch_;
+  addr_t fetchBegin_;
+  addr_t fetchSize_;
+  u32 fetchGeneration_;
+
+  u8 fetch8(addr_t a);
+  bool refill(addr_t a);
+  void sync();
+  ticks_t execute();
+
   void call(addr_t a);
   void ret();
   void rst(addr_t a);
@@ -9,11 +9,19 @@
 #define EMULATOR_H
 
 #include <SFML/Graphics/RenderTarget.hpp>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "common.hpp"
 #include "cpu.hpp"
 #include "gpu.hpp"
 #include "mmuimpl.hpp"
+#include "spscqueue.hpp"
 #include "registers.hpp"
 
 namespace gbg {
@@ -25,21 +33,232 @@ public:
   void nextFrame();
   ticks_t nextTicks();
 
-  void reset();
+  /**
+   * Run for at least ticks, returns elapsed ticks
+   *
+   * Stops early when a breakpoint is hit.
+   */
+  ticks_t runFor(ticks_t ticks);
+
+  /**
+   * Run until the next frame is completed
+   *
+   * Returns false when stopped by a breakpoint.
+   */
+  bool runUntilFrame();
+
+  /**
+   * Run until pc reaches address, for at most limit ticks
+   */
+  bool runUntil(addr_t pc, ticks_t limit);
+
+  /**
+   * Run until condition(emulator) holds, for at most limit ticks
+   *
+   * Condition is checked every scanline (456 ticks), not every instruction.
+   */
+  template <typename Condition,
+            typename = std::enable_if_t<std::is_invocable_v<Condition &,
+                                                             Emulator &>>>
+  bool runUntil(Condition done, ticks_t limit);
+
+  /**
+   * Whether last run stopped at a breakpoint
+   */
+  bool stopped() const;
+
+  bool addBreakpoint(addr_t pc);
+  bool removeBreakpoint(addr_t pc);
+  const std::vector<addr_t> &breakpoints() const;
+
+  void addWatchpoint(addr_t addr, u8 kind);
+  bool removeWatchpoint(addr_t addr);
+  const std::vector<Watchpoint> &watchpoints() const;
+
+  /**
+   * Watchpoint that stopped the last run, if any
+   */
+  const Watchpoint *watchHit() const;
+
+  /**
+   * Power on with bios and cartridge loaded from disk
+   *
+   * With fastBoot the boot rom is not executed, execution starts at 0x0100
+   * with registers, io and video ram as the boot rom of model leaves them.
+   */
+  void reset(Model model = Model::DMG, bool fastBoot = false);
   void render(sf::RenderTarget &renderer);
 
-  MMU &getMMU();
+  /**
+   * Rom loaded on reset, cartridge.gb by default, also points the save path
+   * at the rom with a .sav extension
+   */
+  void setCartridgePath(const std::string &path);
+
+  /**
+   * File keeping battery backed cartridge ram, mapped on reset, empty keeps
+   * it in memory only, cartridge.sav by default
+   */
+  void setSavePath(const std::string &path);
+
+  /**
+   * Write battery backed cartridge ram back to its file, wait blocks until
+   * it reaches the disk
+   */
+  void flushSaveRam(bool wait = false);
+
+  /**
+   * Time base of the cartridge clock, see MMUImpl::setRtcClock
+   */
+  void setRtcClock(RtcClock clock);
+
+  /**
+   * Last completed frame, Gpu::kScreenWidth x Gpu::kScreenHeight RGBA
+   */
+  const buffer_t &screen() const;
+
+  /**
+   * Skip scanline rendering for frames that are not going to be shown
+   */
+  void setRendering(bool enabled);
+
+  /**
+   * Frames to render before the end of a run for the screen to be whole,
+   * the last frame completed may have started that many frames back
+   */
+  u32 renderFrames() const;
+
+  /**
+   * Render palette shade indices into shades instead of RGBA into screen,
+   * see Gpu::setShadeOutput
+   */
+  void setShadeOutput(u8 *shades);
+
+  /**
+   * Pressed buttons, Button mask
+   */
+  void setButtons(u8 buttons);
+
+  static const size_t kJoypadQueueSize = 256;
+  typedef SpscQueue<JoypadEvent, kJoypadQueueSize> JoypadQueue;
+
+  /**
+   * Button changes timestamped in emulated cycles
+   *
+   * Wait-free, a single thread other than the emulation one may produce.
+   * The queue is checked every scanline while it is empty, so an event
+   * queued for a cycle already running is applied up to a scanline late.
+   */
+  JoypadQueue &joypad();
+
+  /**
+   * Keep the joypad events applied from now on, replayJoypad() applies
+   * them again after a load() rolled the timeline back past them
+   */
+  void recordJoypad();
+  void replayJoypad();
+
+  /**
+   * Emulated cycles since reset
+   *
+   * Safe to read from the joypad producer, published every scanline while
+   * running and after every run.
+   */
+  ticks_t cycles() const;
+
+  MMUImpl &getMMU();
   Registers &getRegisters();
 
+  /**
+   * Machine state
+   *
+   * Plain data, saving and loading are struct copies dominated by the single
+   * copy of the memory block. Roms are not part of it, cartridge ram follows
+   * it in saved states, see stateSize.
+   */
+  struct State {
+    u32 version;
+    Registers regs;
+    Gpu::State gpu;
+    ticks_t counter;
+    ticks_t cycles;
+    MMUImpl::State mmu;
+  };
+
+  static const u32 kStateVersion = 7;
+
+  /**
+   * Bytes of a saved state, the State then the cartridge ram
+   */
+  size_t stateSize() const;
+
+  /**
+   * Resize state to stateSize() and save into it, no allocation when it is
+   * already of that size
+   */
+  void save(buffer_t &state) const;
+
+  /**
+   * Throws if state was saved by a different version or for a cartridge
+   * with another ram size, clears a pending stop
+   */
+  void load(const buffer_t &state);
+
+  void saveState(const std::string &path) const;
+  void loadState(const std::string &path);
+
+  /**
+   * Child emulator sharing memory with this one copy-on-write
+   *
+   * Cost is proportional to the ram pages either side writes afterwards.
+   * Breakpoints, watchpoints and the rendered screen are not inherited.
+   */
+  std::unique_ptr<Emulator> fork();
+
 private:
+  static const ticks_t kScanlineDuration = 456;
+
   MMUImpl mmu_;
   Gpu gpu_;
   Cpu cpu_;
 
   ticks_t counter_;
+  ticks_t cycles_;
+  const u8 fps_;
   const ticks_t frameDuration_;
+
+  std::atomic<ticks_t> publishedCycles_; // cycles_ for other threads
+
+  JoypadQueue joypad_;
+  ticks_t nextJoypad_;
+  std::deque<JoypadEvent> joypadReplay_; // applied before the queue
+  std::vector<JoypadEvent> joypadLog_;
+  bool joypadRecording_;
+
+  std::string cartridgePath_;
+  std::string savePath_;
+
+  void pollJoypad();
+  void applyJoypad(const JoypadEvent &event);
+
+  template <typename Stop> ticks_t run(ticks_t limit, Stop stop);
 };
 
+template <typename Condition, typename>
+bool Emulator::runUntil(Condition done, ticks_t limit) {
+  ticks_t elapsed = 0;
+  while (!done(*this)) {
+    if (elapsed >= limit) {
+      return false;
+    }
+    elapsed += runFor(std::min(kScanlineDuration, limit - elapsed));
+    if (cpu_.stopped()) {
+      return done(*this);
+    }
+  }
+  return true;
+}
+
 } // namespace gbg
 
 #endif /* !EMULATOR_H */
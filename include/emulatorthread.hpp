@@ -0,0 +1,178 @@
+/*
+ * emulatorthread.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef EMULATORTHREAD_H
+#define EMULATORTHREAD_H
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+#include "emulator.hpp"
+#include "movie.hpp"
+#include "pacer.hpp"
+#include "rewind.hpp"
+#include "runahead.hpp"
+#include "spscqueue.hpp"
+#include "triplebuffer.hpp"
+
+namespace gbg {
+
+enum InputKind : u8 {
+  kInputToggleRun,
+  kInputStep,
+  kInputToggleZero,
+  kInputSaveState,
+  kInputLoadState,
+  kInputAddBreakpoint,
+  kInputRemoveBreakpoint,
+  kInputAddWatchpoint, // flags is the watch kind
+  kInputRemoveWatchpoint,
+  kInputFastForward, // flags is on/off
+  kInputRewind,      // flags is on/off
+  kInputSpeed,       // value is the fast-forward multiplier, 0 unlimited
+  kInputFrameSkip,   // value is frames per shown frame when unlimited
+  kInputPacing,      // flags is the pacing strategy
+  kInputButtons,     // flags is the Button mask
+};
+
+struct Input {
+  u8 kind;
+  u8 flags;
+  addr_t addr;
+  float value;
+};
+
+/**
+ * Machine state published once per emulated host frame
+ */
+struct Snapshot {
+  static const size_t kCodeSize = 64;
+
+  buffer_t screen;
+
+  Registers regs;
+  std::array<u8, MemSize::kHwIO> io;
+  u8 ie;
+
+  // memory from pc on, for disassembly
+  std::array<u8, kCodeSize> code;
+
+  bool running;
+  bool stopped;
+  bool watched;
+  Watchpoint watchHit;
+  std::vector<addr_t> breakpoints;
+  std::vector<Watchpoint> watchpoints;
+
+  float emulatedFps;
+
+  u8 pacing;
+  Pacer::Stats frameTimes;
+  float refreshRate;
+
+  u8 runAheadFrames;
+  RunAhead::Timing runAhead;
+
+  u64 rewindFrames;
+  size_t rewindUsed;
+  double rewindBytesPerMinute;
+
+  std::string error;
+};
+
+/**
+ * Runs and paces the emulator on its own thread
+ *
+ * Input reaches it through a wait-free queue and snapshots come back
+ * through a triple buffer, so that neither the emulator nor the ui ever
+ * waits on the other.
+ */
+class EmulatorThread {
+public:
+  /**
+   * Battery backed cartridge ram is flushed to its file, next to the rom at
+   * cartridgePath, every saveInterval seconds and on exit
+   *
+   * With a recordPath every frame is recorded into a movie written there on
+   * exit. Recording runs no frames ahead, and ignores stepping, rewinding
+   * and loading states, which the movie cannot follow.
+   */
+  EmulatorThread(const std::string &cartridgePath, u8 fps, Model model,
+                 bool fastBoot, u8 runAheadFrames, float saveInterval = 1.0f,
+                 RtcClock rtc = kRtcEmulated,
+                 const std::string &recordPath = "");
+  ~EmulatorThread();
+
+  EmulatorThread(const EmulatorThread &) = delete;
+  EmulatorThread &operator=(const EmulatorThread &) = delete;
+
+  /**
+   * Ui thread side, false if the queue is full
+   */
+  bool send(const Input &input);
+
+  /**
+   * Ui thread side, takes the latest snapshot, false if there is no new one
+   */
+  bool update();
+  const Snapshot &snapshot() const;
+
+  /**
+   * Ui thread side, display refreshed, drives vsync pacing
+   */
+  void vsync();
+
+  /**
+   * Ui thread side, stop emulating, flush the save ram and write the movie
+   * recorded, done on destruction otherwise
+   */
+  void stop();
+
+private:
+  static const size_t kInputQueueSize = 256;
+
+  Emulator emulator_;
+  Rewind rewind_;
+  RunAhead runAhead_;
+  Pacer pacer_;
+  Movie movie_;
+  const std::string recordPath_;
+
+  SpscQueue<Input, kInputQueueSize> inputs_;
+  TripleBuffer<Snapshot> snapshots_;
+
+  std::atomic<bool> quit_;
+
+  // Owned by the emulation thread
+  bool running_;
+  bool fastForward_;
+  bool rewinding_;
+  float speed_;
+  int frameSkip_;
+  float pendingFrames_;
+  u8 buttons_;
+  u64 emulatedFrames_;
+  float emulatedFps_;
+  const float saveInterval_;
+  std::string error_;
+
+  std::thread thread_;
+
+  void loop();
+  void apply(const Input &input);
+  void runFrame();
+  void nextFrame();
+  void publish();
+};
+
+} // namespace gbg
+
+#endif /* !EMULATORTHREAD_H */
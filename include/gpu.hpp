@@ -21,11 +21,58 @@ class MMUImpl;
 
 class Gpu {
 public:
+  static const size_t kScreenWidth = 160;
+  static const size_t kScreenHeight = 144;
+  static const ticks_t kFrameDuration = 70224; // ticks between frames
+
   Gpu(MMUImpl &mmu);
 
   void render(sf::RenderTarget &renderer);
+  void reset();
   void step(ticks_t elapsedTicks);
 
+  /**
+   * Number of frames completed (vertical blank entered)
+   */
+  u64 frame() const;
+
+  /**
+   * Ticks left until the next frame is completed
+   */
+  ticks_t ticksToFrame();
+
+  /**
+   * Last completed frame, kScreenWidth x kScreenHeight RGBA pixels
+   */
+  const buffer_t &screen() const;
+
+  /**
+   * When disabled scanlines are not rendered and the screen keeps the last
+   * rendered frame, timing and interrupts are unaffected
+   *
+   * Only frames with every scanline rendered reach the screen, a frame
+   * partly drawn before rendering was enabled or before a restore is
+   * dropped.
+   */
+  void setRendering(bool enabled);
+
+  /**
+   * Render shade indices (0-3, background and sprite palettes applied) into
+   * shades instead of RGBA pixels into screen, nullptr restores RGBA
+   *
+   * Shades must hold kScreenWidth x kScreenHeight bytes, each scanline is
+   * written in place as it is rendered.
+   */
+  void setShadeOutput(u8 *shades);
+
+  struct State {
+    u8 scanline;
+    ticks_t counter;
+  };
+
+  const State &state() const;
+  void restore(const State &state);
+
 private:
   static const size_t kPaletteSize = 4;
 
@@ -38,12 +85,17 @@ private:
   MMUImpl &mmu_;
 
   u8 mode_;
-  u8 scanline_;
 
-  ticks_t counter_;
+  State state_;
+  u64 frame_;
+  bool rendering_;
+  bool complete_; // every scanline of the frame being rendered was drawn
 
   u8 palette_[kPaletteSize][kColorComponentSize];
-  buffer_t pixels_;
+  buffer_t pixels_; // frame being rendered
+  buffer_t screen_; // last completed frame
+  u8 *shades_;      // shade output, replaces pixels when set
+  bool uploaded_;
 
   std::unique_ptr<sf::Texture> texture_;
   std::unique_ptr<sf::Sprite> viewport_;
@@ -53,11 +105,17 @@ private:
 
   u8 getScanline();
   void setScanline(u8 scanline);
+  u8 compareScanline();
+
+  u8 &io(addr_t addr);
+  u8 readIo(u8 index);
+  void writeIo(u8 index, u8 value);
 
   void renderScanline();
   void clearScanline(u8 scanline);
   void renderScanlineBackground(u8 scanline);
   void renderScanlineSprites(u8 scanline);
+  void plot(size_t column, u8 scanline, u8 shade);
 
   bool isBackgroundEnable();
 
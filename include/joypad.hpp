@@ -0,0 +1,43 @@
+/*
+ * joypad.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef JOYPAD_H
+#define JOYPAD_H
+
+#include "common.hpp"
+
+namespace gbg {
+
+/**
+ * Pressed buttons mask, low nibble is read through P1 when directions are
+ * selected and high nibble when buttons are
+ */
+enum Button : u8 {
+  kButtonRight = 1 << 0,
+  kButtonLeft = 1 << 1,
+  kButtonUp = 1 << 2,
+  kButtonDown = 1 << 3,
+  kButtonA = 1 << 4,
+  kButtonB = 1 << 5,
+  kButtonSelect = 1 << 6,
+  kButtonStart = 1 << 7,
+};
+
+/**
+ * Buttons pressed from emulated cycle on
+ *
+ * Events must be queued in cycle order. Events already in the past are
+ * applied before the next instruction.
+ */
+struct JoypadEvent {
+  ticks_t cycle;
+  u8 buttons;
+};
+
+} // namespace gbg
+
+#endif /* !JOYPAD_H */
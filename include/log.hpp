@@ -0,0 +1,178 @@
+/*
+ * log.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "common.hpp"
+
+enum LogLevel : u8 {
+  kLogError = 0,
+  kLogWarning = 1,
+  kLogInfo = 2,
+  kLogDebug = 3,
+  kLogTrace = 4,
+};
+
+enum LogCategory : u32 {
+  kLogApp = 1 << 0,
+  kLogCpu = 1 << 1,
+  kLogMemory = 1 << 2,
+  kLogDma = 1 << 3,
+  kLogTimer = 1 << 4,
+  kLogVideo = 1 << 5,
+  kLogJoypad = 1 << 6,
+};
+
+// Most verbose level compiled in
+#ifndef GBG_LOG_LEVEL
+#ifdef NDEBUG
+#define GBG_LOG_LEVEL kLogInfo
+#else
+#define GBG_LOG_LEVEL kLogDebug
+#endif
+#endif
+
+// Categories compiled in
+#ifndef GBG_LOG_CATEGORIES
+#define GBG_LOG_CATEGORIES 0xffffffffu
+#endif
+
+/**
+ * Log message at emulated cycle
+ *
+ * Levels above GBG_LOG_LEVEL and categories outside GBG_LOG_CATEGORIES are
+ * discarded at compile time, arguments are not evaluated. Format is copied
+ * by pointer and must be a literal, {} is replaced by the next argument and
+ * {x} by the next argument in hex.
+ */
+#define GBG_LOG(level, category, cycle, ...)                                   \
+  do {                                                                         \
+    if constexpr ((level) <= GBG_LOG_LEVEL &&                                  \
+                  ((category) & GBG_LOG_CATEGORIES) != 0) {                    \
+      if (gbg::Log::enabled(category)) {                                       \
+        gbg::Log::write(level, category, cycle, __VA_ARGS__);                  \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+namespace gbg {
+
+/**
+ * Structured log
+ *
+ * Messages are queued unformatted into a lock-free ring, any thread may
+ * write. A background thread formats and drains them to stderr or a file.
+ * Messages are dropped when the ring is full.
+ */
+class Log {
+public:
+  static const size_t kArgs = 4;
+  static const size_t kTextSize = 48;
+
+  struct Record {
+    ticks_t cycle;
+    const char *format;
+    u32 category;
+    u8 level;
+    u8 count;
+
+    enum Type : u8 { kSigned, kUnsigned, kReal, kText };
+    Type types[kArgs];
+    union {
+      s64 i;
+      u64 u;
+      double d;
+    } args[kArgs];
+
+    // copy of the text argument, at most one per message
+    char text[kTextSize];
+  };
+
+  /**
+   * Categories written at runtime, all by default
+   */
+  static void setMask(u32 categories);
+  static bool enabled(u32 category) {
+    return mask_.load(std::memory_order_relaxed) & category;
+  }
+
+  template <typename... Args>
+  static void write(u8 level, u32 category, ticks_t cycle, const char *format,
+                    const Args &... args) {
+    static_assert(sizeof...(Args) <= kArgs, "too many log arguments");
+
+    Record record = Record();
+    record.cycle = cycle;
+    record.format = format;
+    record.category = category;
+    record.level = level;
+    (set(record, args), ...);
+    push(record);
+  }
+
+  /**
+   * Start draining to path, stderr when empty
+   */
+  static void start(const std::string &path = "");
+
+  /**
+   * Drain what is left and stop, messages written after stay queued
+   */
+  static void stop();
+
+  /**
+   * Take the oldest message formatted, false when there is none, for a
+   * single consumer
+   */
+  static bool pop(std::string &line);
+
+  /**
+   * Messages dropped because the ring was full
+   */
+  static u64 dropped();
+
+private:
+  static std::atomic<u32> mask_;
+
+  static void push(const Record &record);
+
+  template <typename T> static void set(Record &record, const T &value) {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                  "log arguments are numbers or text");
+    size_t n = record.count++;
+    if constexpr (std::is_floating_point<T>::value) {
+      record.types[n] = Record::kReal;
+      record.args[n].d = value;
+    } else if constexpr (std::is_signed<T>::value) {
+      record.types[n] = Record::kSigned;
+      record.args[n].i = value;
+    } else {
+      record.types[n] = Record::kUnsigned;
+      record.args[n].u = value;
+    }
+  }
+
+  static void set(Record &record, const char *value) {
+    record.types[record.count++] = Record::kText;
+    std::strncpy(record.text, value, kTextSize - 1);
+    record.text[kTextSize - 1] = '\0';
+  }
+
+  static void set(Record &record, const std::string &value) {
+    set(record, value.c_str());
+  }
+};
+
+} // namespace gbg
+
+#endif /* !LOG_H */
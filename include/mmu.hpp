@@ -31,12 +31,12 @@ public:
   virtual u8 read(addr_t src) = 0;
 
   /**
-   * Execute internal dma transfer
+   * Advance timers and dma by ticks
    */
   virtual void step(ticks_t ticks) = 0;
 
   /**
-   * Begin DMA transfer
+   * Begin DMA transfer, objects memory is busy until it completes
    */
   virtual void transfer(addr_t dst, addr_t src) = 0;
 
@@ -44,6 +44,54 @@ public:
    * Write value to destination address
    */
   virtual void write(addr_t dst, u8 value) = 0;
+
+  /**
+   * Read value contained into zero page address (0xff00 + offset)
+   */
+  virtual u8 zread(u8 offset) = 0;
+
+  /**
+   * Write value to zero page address (0xff00 + offset)
+   */
+  virtual void zwrite(u8 offset, u8 value) = 0;
+
+  /**
+   * Push word into the stack and move stack pointer down
+   */
+  virtual void push(addr_t &sp, u16 value) = 0;
+
+  /**
+   * Pop word from the stack and move stack pointer up
+   */
+  virtual u16 pop(addr_t &sp) = 0;
+
+  /**
+   * Host memory backing the region that contains address
+   *
+   * On success returns the host pointer of begin, the region spans from begin
+   * up to end (exclusive). Returns nullptr when the address is not backed by
+   * plain memory (io registers, unusable area).
+   *
+   * Pointers are valid until generation changes.
+   */
+  virtual const u8 *window(addr_t src, addr_t &begin, addr_t &end) = 0;
+
+  /**
+   * Incremented whenever memory mapping changes (bank switch, boot rom
+   * unmapped, new rom loaded)
+   */
+  u32 generation() const { return generation_; }
+
+  /**
+   * Set when an access hit a watchpoint, the cpu stops before the next
+   * instruction and clears it
+   */
+  bool trapped() const { return trapped_; }
+  void clearTrap() { trapped_ = false; }
+
+protected:
+  u32 generation_ = 0;
+  bool trapped_ = false;
 };
 
 } // namespace gbg
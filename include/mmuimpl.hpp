@@ -8,14 +8,53 @@
 #ifndef MMUIMPL_H
 #define MMUIMPL_H
 
+#include <array>
+#include <bitset>
+#include <memory>
+#include <vector>
+
+#include "joypad.hpp"
 #include "mmu.hpp"
+#include "saveram.hpp"
+#include "watchpoint.hpp"
 
 namespace gbg {
 
+namespace MemAddr {
+static const addr_t kBiosROM = 0x0000;
+static const addr_t kCartridgeROM = 0x0000;
+static const addr_t kVideoRAM = 0x8000;
+static const addr_t kCartridgeRAM = 0xA000;
+static const addr_t kLowRAM = 0xC000;
+static const addr_t kEchoRAM = 0xE000;
+static const addr_t kOamRAM = 0xFE00;
+static const addr_t kInvRAM = 0xFEA0;
+static const addr_t kHwIO = 0xFF00;
+static const addr_t kHighRAM = 0xFF80;
+} // namespace MemAddr
+
+namespace MemSize {
+static const size_t kBiosROM = 0x0100;
+static const size_t kCartridgeROM = 0x8000;
+static const size_t kVideoRAM = 0x2000;
+static const size_t kCartridgeRAM = 0x2000;
+static const size_t kLowRAM = 0x2000;
+static const size_t kEchoRAM = 0x1E00;
+static const size_t kOamRAM = 0x00A0;
+static const size_t kInvRAM = 0x0060;
+static const size_t kHwIO = 0x0080;
+static const size_t kHighRAM = 0x0080;
+} // namespace MemSize
+
+enum RtcClock : u8 {
+  kRtcEmulated, // follows emulated cycles, deterministic
+  kRtcHost,     // follows host wall time, also while not running
+};
+
 class MMUImpl : public MMU {
 public:
   MMUImpl();
-  virtual ~MMUImpl() = default;
+  virtual ~MMUImpl();
 
   u8 read(addr_t src) override;
 
@@ -24,23 +63,352 @@ public:
   void write(addr_t dst, u8 value) override;
   void write(addr_t dst, const buffer_t &data);
 
+  u8 zread(u8 offset) override;
+  void zwrite(u8 offset, u8 value) override;
+
+  void push(addr_t &sp, u16 value) override;
+  u16 pop(addr_t &sp) override;
+
+  const u8 *window(addr_t src, addr_t &begin, addr_t &end) override;
+
+  /**
+   * Device (gpu, debugger) access, not subject to watchpoints
+   */
+  u8 load(addr_t src);
+  void store(addr_t dst, u8 value);
+
+  /**
+   * Trap cpu reads and/or writes to address
+   */
+  void addWatchpoint(addr_t addr, u8 kind);
+  bool removeWatchpoint(addr_t addr);
+
+  const std::vector<Watchpoint> &watchpoints() const;
+
+  /**
+   * Watchpoint hit by the last trapped access
+   */
+  const Watchpoint &watchHit() const;
+
   void loadBios(const buffer_t &bios);
-  void loadCartridge(const buffer_t &rom);
 
-  buffer_t &getOAM();
+  /**
+   * Load rom and map the cartridge ram its header asks for, battery backed
+   * ram is kept in the file at savePath, or in anonymous memory when empty
+   */
+  void loadCartridge(const buffer_t &rom, const std::string &savePath = "");
+
+  const buffer_t &cartridge() const;
+
+  /**
+   * Write battery backed ram back to its file, see SaveRam::flush
+   */
+  void flushSaveRam(bool wait = false);
+
+  /**
+   * Time base of the mbc3 clock, emulated cycles by default, the clock
+   * keeps its value when switched
+   */
+  void setRtcClock(RtcClock clock);
+
+  /**
+   * Bytes of cartridge ram, 0 when the cartridge has none
+   */
+  size_t cartridgeRamSize() const;
+
+  /**
+   * Pressed buttons (Button mask) as seen through P1
+   *
+   * Requests the joypad interrupt when a selected line goes low.
+   */
+  void setButtons(u8 buttons);
+  u8 buttons() const;
+
+  /**
+   * Restore power on memory contents, roms are kept
+   */
+  void reset();
+
+  /**
+   * Unmap boot rom and set io registers and video ram to the state the boot
+   * rom of model leaves them
+   */
+  void skipBios(Model model);
+
+  std::array<u8, MemSize::kOamRAM> &getOAM();
+
+  /**
+   * Io register handler, every cpu and device access to the register is
+   * routed through it
+   */
+  struct IoHandler {
+    void *owner;
+    u8 (*read)(void *owner, u8 index);
+    void (*write)(void *owner, u8 index, u8 value);
+  };
+
+  /**
+   * Handler calling member functions of owner
+   */
+  template <typename T, u8 (T::*Read)(u8), void (T::*Write)(u8, u8)>
+  static IoHandler ioHandler(T *owner) {
+    return {owner,
+            [](void *o, u8 index) {
+              return (static_cast<T *>(o)->*Read)(index);
+            },
+            [](void *o, u8 index, u8 value) {
+              (static_cast<T *>(o)->*Write)(index, value);
+            }};
+  }
+
+  /**
+   * Io index of the interrupt switch (0xffff), other io indices are the
+   * offset from 0xff00
+   */
+  static const u8 kIoInterruptSwitch = 0x80;
+
+  /**
+   * Route accesses to io register index to handler, components register the
+   * registers they emulate, the others read and write their plain storage
+   */
+  void setIoHandler(u8 index, const IoHandler &handler);
+
+  /**
+   * Plain storage of io register index, for handlers and their component
+   */
+  u8 &io(u8 index) {
+    return index < kIoInterruptSwitch ? hwio_[index]
+                                      : hram_[MemSize::kHighRAM - 1];
+  }
+
+  /**
+   * Make child a copy of this memory
+   *
+   * Roms are shared and ram pages are shared copy-on-write, no ram is
+   * copied until either side writes a page, which copies that page only.
+   * Io, oam and high ram are copied, cartridge ram into anonymous memory of
+   * the child. Watchpoints are not inherited.
+   */
+  void fork(MMUImpl &child);
+
+  /**
+   * Ram pages not written since the last fork
+   */
+  size_t sharedPages() const;
+
+  typedef std::bitset<0x100> PageSet;
+
+  /**
+   * Pages (256 bytes each) of the address space written since the dirty
+   * generation since, 0 for all, returns the generation to pass next time
+   *
+   * Every consumer keeps its own generation, none clears the view of the
+   * others. Writes to echo ram mark the low ram page; io registers changed
+   * by devices rather than stores are not tracked.
+   */
+  u32 dirtyPages(u32 since, PageSet &pages);
+
+  /**
+   * Mutable memory, plain data so that it is saved/restored with block
+   * copies, starts laid out as the arena
+   */
+  struct State {
+    std::array<u8, MemSize::kVideoRAM> vram; // video ram
+    std::array<u8, MemSize::kLowRAM> lram;   // low ram
+    std::array<u8, MemSize::kOamRAM> oram;   // object attribute memory
+    std::array<u8, MemSize::kHwIO> hwio;     // hardware io
+    std::array<u8, MemSize::kHighRAM> hram;  // high ram (zero memory)
+
+    ticks_t divider; // system counter, DIV is its upper byte
+    ticks_t dma;     // cycles left of the oam dma
+    u8 buttons;
+
+    // memory bank controller registers
+    u16 romBank;
+    u8 ramBank;
+    u8 ramEnabled;
+    u8 bankMode;
+
+    // mbc3 clock
+    ticks_t rtc;     // clock cycles counted
+    ticks_t rtcHost; // host time of rtc in cycles, 0 unless host clock
+    u8 rtcHalt;
+    u8 rtcCarry;
+    u8 rtcLatch;
+    std::array<u8, 5> rtcLatched;
+  };
+
+  /**
+   * Cartridge ram is saved apart as its size varies, cram holds
+   * cartridgeRamSize() bytes, it is left out when null
+   */
+  void save(State &state, u8 *cram = nullptr) const;
+  void restore(const State &state, const u8 *cram = nullptr);
 
 private:
-  buffer_t bios_; // bios
-  buffer_t crom_; // cartridge rom
-  buffer_t vram_; // video ram
-  buffer_t cram_; // cartridge ram
-  buffer_t lram_; // low ram
-  buffer_t oram_; // object attribute memory
-  buffer_t hwio_; // hardware io
-  buffer_t hram_; // high ram (zero memory)
-
-  ticks_t timer_;
-  ticks_t divider_;
+  static const size_t kIoRegisters = kIoInterruptSwitch + 1;
+
+  static const size_t kPageSize = 0x100;
+
+  // Video and low ram, low ram pages follow the video ones
+  static const size_t kPages =
+      (MemSize::kVideoRAM + MemSize::kLowRAM) / kPageSize;
+
+  static const size_t kRomBankSize = 0x4000;
+
+  /**
+   * Video and low ram pages in a single block, refcounted so that forks
+   * share it, written only by the instance that allocated it
+   */
+  struct alignas(64) RamBlock {
+    std::array<u8, MemSize::kVideoRAM> vram;
+    std::array<u8, MemSize::kLowRAM> lram;
+
+    u8 *page(size_t index) { return vram.data() + index * kPageSize; }
+  };
+
+  /**
+   * Fixed size guest memory private to the instance in a single block
+   */
+  struct alignas(64) Arena {
+    std::array<u8, MemSize::kOamRAM> oram;
+    std::array<u8, MemSize::kHwIO> hwio;
+    std::array<u8, MemSize::kHighRAM> hram;
+  };
+
+  std::shared_ptr<const buffer_t> bios_; // bios
+  std::shared_ptr<const buffer_t> crom_; // cartridge rom
+
+  // Mapping written cartridge ram pages are copied into, the save file of
+  // battery backed ram. Anonymous mappings are dropped on fork like ram_,
+  // the save file is written in place so it is never shared.
+  std::shared_ptr<SaveRam> saveRam_;
+
+  // Mapping holding every cartridge ram page, reads go through cramPages_
+  // and writes through cramWritable_ as with the other ram pages
+  std::vector<std::shared_ptr<const SaveRam>> cramBlocks_;
+  std::vector<const u8 *> cramPages_;
+  std::vector<u8 *> cramWritable_;
+
+  enum Mbc : u8 { kMbcNone, kMbc1, kMbc3, kMbc5 };
+
+  // Memory bank controller, rom bank is switched in at 0x4000 and ram bank
+  // at kCartridgeRAM, both wrap around the cartridge sizes
+  u8 mbc_;
+  u16 romBank_;
+  u8 ramBank_;
+  bool ramEnabled_;
+  u8 bankMode_; // mbc1 only, ram banking when set
+  size_t ramSize_;
+
+  // Mbc3 clock, runs from rtcBase_ cycles at rtcEpoch_ of its time base
+  // and is only broken into registers when latched, battery backed ram
+  // keeps it in a footer after the ram.
+  RtcClock rtcClock_;
+  bool rtc_; // cartridge has a clock
+  ticks_t rtcBase_;
+  ticks_t rtcEpoch_;
+  bool rtcHalt_;
+  bool rtcCarry_;
+  u8 rtcLatch_;      // last write to the latch register
+  u8 rtcLatched_[5]; // registers as of the last latch
+
+  std::unique_ptr<Arena> arena_;
+
+  // Block written pages are copied into, dropped on fork so that blocks
+  // are never written once shared, allocated again by the next write
+  std::shared_ptr<RamBlock> ram_;
+
+  // Block holding every ram page. Reads go through pages_, writes through
+  // writable_ which is null until the page is copied into ram_.
+  std::shared_ptr<const RamBlock> blocks_[kPages];
+  const u8 *pages_[kPages];
+  u8 *writable_[kPages];
+
+  std::array<u8, MemSize::kOamRAM> &oram_;  // object attribute memory
+  std::array<u8, MemSize::kHwIO> &hwio_;    // hardware io
+  std::array<u8, MemSize::kHighRAM> &hram_; // high ram (zero memory)
+
+  // Host memory of every 256 bytes page of the address space, null where
+  // accesses take the slow path (io, oam, watched pages, writes to roms and
+  // shared pages). The boot rom is the mapping of page 0 until unmapped.
+  const u8 *reads_[0x100];
+  u8 *writes_[0x100];
+
+  // Dirty generation of the last write to every page. Ram pages are mapped
+  // for writing only once written in the current generation, so the first
+  // write after each query takes the slow path and marks the page.
+  u32 dirty_[0x100];
+  u32 dirtyGeneration_;
+
+  // DIV and TIMA are derived from the clock when read, overflow of TIMA
+  // is the only timer event
+  ticks_t clock_;      // cycles stepped since reset
+  ticks_t divBase_;    // clock when the system counter was zero
+  ticks_t timaBase_;   // clock when TIMA was tima_
+  ticks_t timerEvent_; // clock of the next TIMA overflow
+  u8 tima_;
+
+  // Oam is copied at once when dma starts, the cpu sees it busy until then
+  ticks_t dmaEnd_;
+
+  u8 buttons_;
+
+  u8 *own(u8 page);
+  RamBlock &ownAll();
+  u8 &ram(addr_t addr);
+  u8 *ownCram(size_t index);
+  SaveRam &ownAllCram();
+  void map(u8 page);
+  void mapAll();
+  void remap(u8 page);
+  void touch(u8 page);
+  u8 loadSlow(addr_t src);
+  void storeSlow(addr_t dst, u8 value);
+
+  size_t romOffset(addr_t addr) const;
+  size_t ramOffset(addr_t addr) const;
+  void writeMbc(addr_t dst, u8 value);
+  bool rtcSelected() const;
+  ticks_t rtcNow() const;
+  ticks_t rtcCycles() const;
+  void latchRtc();
+  void writeRtc(u8 reg, u8 value);
+  void loadRtc();
+  void storeRtc();
+
+  IoHandler ioHandlers_[kIoRegisters];
+
+  u8 readIo(u8 index);
+  void writeIo(u8 index, u8 value);
+  u8 readDivider(u8 index);
+  void writeDivider(u8 index, u8 value);
+  u8 readTimerCounter(u8 index);
+  void writeTimerCounter(u8 index, u8 value);
+  void writeTimerControl(u8 index, u8 value);
+  u8 timerCounter() const;
+  bool timerSignal() const;
+  void loadTimer(ticks_t counter);
+  void rebaseTimer();
+  void scheduleTimer();
+  void tickTimer();
+  void timerOverflow();
+  void writeDma(u8 index, u8 value);
+  void writeBootLatch(u8 index, u8 value);
+  u8 readJoypad(u8 index);
+  void writeJoypad(u8 index, u8 value);
+  void joypadInterrupt(u8 lines);
+
+  // Watchpoints per 256 bytes page, zero for pages accessed at full speed,
+  // wide enough for a watchpoint on every address of the page
+  u16 watchPages_[0x100];
+  std::vector<Watchpoint> watchpoints_;
+  Watchpoint watchHit_;
+
+  void watch(addr_t addr, u8 value, u8 kind);
+
+  const u8 *stack(addr_t sp) const;
+  u8 *writableStack(addr_t sp);
 };
 
 } // namespace gbg
@@ -0,0 +1,88 @@
+/*
+ * movie.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "emulator.hpp"
+
+namespace gbg {
+
+/**
+ * Input movie
+ *
+ * Buttons pressed on every frame plus a save state keyframe every interval
+ * frames, tied to the cartridge it was recorded with. Keyframe 0 is the
+ * state recording started from, so movies need not start at power on.
+ */
+class Movie {
+public:
+  Movie();
+
+  /**
+   * Start a new recording from the current emulator state
+   */
+  void record(Emulator &emulator, u32 interval = 600);
+
+  /**
+   * Press buttons and advance one frame, recording over any input past the
+   * current frame
+   */
+  void recordFrame(Emulator &emulator, u8 buttons);
+
+  /**
+   * Advance one frame with the recorded input, false at the end
+   */
+  bool playFrame(Emulator &emulator);
+
+  /**
+   * Restore the nearest keyframe far enough before frame and run from it
+   * to frame, rendering only the frames the screen shown at frame spans.
+   * Within Emulator::renderFrames() of the start that screen is not whole
+   * and the previous one is kept.
+   *
+   * Throws if emulator runs a different cartridge.
+   */
+  void seek(Emulator &emulator, u32 frame);
+
+  /**
+   * Current frame
+   */
+  u32 frame() const;
+  u32 frames() const;
+
+  void save(const std::string &path) const;
+
+  /**
+   * Throws if file is not a movie or was saved by a different version
+   */
+  void load(const std::string &path);
+
+  static u64 hash(const buffer_t &rom);
+
+private:
+  struct Keyframe {
+    u32 frame;
+    buffer_t state;
+  };
+
+  u64 romHash_;
+  u32 interval_;
+  u32 frame_;
+  std::vector<u8> inputs_;
+  std::vector<Keyframe> keyframes_;
+
+  void check(Emulator &emulator) const;
+};
+
+} // namespace gbg
+
+#endif /* !MOVIE_H */
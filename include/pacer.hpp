@@ -0,0 +1,98 @@
+/*
+ * pacer.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "common.hpp"
+
+namespace gbg {
+
+enum Pacing : u8 {
+  kPacingHybrid, // sleep until slack before the deadline, then spin
+  kPacingVsync,  // follow the display refresh reported by vsync()
+};
+
+/**
+ * Frame pacing
+ *
+ * Deadlines are absolute so that errors do not accumulate. Hybrid pacing
+ * sleeps until a measured slack before the deadline, the slack tracks the
+ * worst recent oversleep, and spins the rest. Vsync pacing phase locks the
+ * deadlines to the display refresh timestamps reported by the ui thread.
+ */
+class Pacer {
+public:
+  static const size_t kSamples = 256;
+  static const size_t kHistogramBuckets = 40; // 1ms each
+
+  Pacer(u8 fps);
+
+  void setPacing(Pacing pacing);
+  Pacing pacing() const;
+
+  /**
+   * End of a frame, wait until the next one is due
+   */
+  void wait();
+
+  /**
+   * End of an unthrottled frame, only recorded
+   */
+  void mark();
+
+  /**
+   * Display refreshed, called from the ui thread right after presenting
+   */
+  void vsync();
+
+  /**
+   * Measured display refresh rate, 0 until vsync() is called
+   */
+  float refreshRate() const;
+
+  struct Stats {
+    float p50; // frame time in ms
+    float p95;
+    float p99;
+    float slack; // ms
+    std::array<float, kHistogramBuckets> histogram;
+  };
+
+  /**
+   * Statistics over the last kSamples frames
+   */
+  Stats stats() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  const Clock::duration period_;
+  Pacing pacing_;
+
+  Clock::time_point deadline_;
+  Clock::time_point last_;
+  Clock::duration slack_;
+
+  std::array<float, kSamples> samples_;
+  size_t sampled_;
+
+  // written by the ui thread, nanoseconds
+  std::atomic<s64> vsyncTs_;
+  std::atomic<s64> vsyncPeriod_;
+
+  void sleepUntil(Clock::time_point deadline);
+  void record();
+};
+
+} // namespace gbg
+
+#endif /* !PACER_H */
@@ -0,0 +1,92 @@
+/*
+ * rewind.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <deque>
+
+#include "common.hpp"
+#include "emulator.hpp"
+
+namespace gbg {
+
+/**
+ * Rewind history
+ *
+ * Captures emulator state every interval frames into a fixed size ring.
+ * Only the newest state is kept whole, each older one is stored as the
+ * run-length encoded xor against its successor, which is mostly zeros as
+ * little memory changes between captures.
+ */
+class Rewind {
+public:
+  Rewind(size_t capacity, u32 interval);
+
+  /**
+   * Call once per emulated frame, captures every interval frames
+   */
+  void capture(const Emulator &emulator);
+
+  /**
+   * Restore the previous capture, false when history is exhausted
+   */
+  bool step(Emulator &emulator);
+
+  void clear();
+
+  /**
+   * Frames of history available
+   */
+  u64 frames() const;
+
+  size_t used() const;
+  size_t capacity() const;
+
+  /**
+   * Average ring usage per minute of history (60 fps)
+   */
+  double bytesPerMinute() const;
+
+  /**
+   * Run-length encode the xor of a and b into out, replacing its contents
+   */
+  static void encode(const u8 *a, const u8 *b, size_t size, buffer_t &out);
+
+  /**
+   * Xor encoded runs into dst, turning b into a or a into b
+   */
+  static void decode(const u8 *in, size_t inSize, u8 *dst);
+
+private:
+  struct Entry {
+    size_t offset;
+    size_t size;
+  };
+
+  const u32 interval_;
+  u32 counter_;
+
+  bool valid_;
+  buffer_t current_;
+  buffer_t next_;
+
+  buffer_t ring_;
+  size_t head_;
+  size_t used_;
+  std::deque<Entry> entries_;
+
+  buffer_t scratch_;
+  u64 encoded_;
+  u64 captures_;
+
+  u8 *allocate(size_t size);
+};
+
+} // namespace gbg
+
+#endif /* !REWIND_H */
@@ -0,0 +1,62 @@
+/*
+ * runahead.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <chrono>
+
+#include "common.hpp"
+#include "emulator.hpp"
+
+namespace gbg {
+
+/**
+ * Run-ahead input latency reduction
+ *
+ * Each frame the emulator advances one hidden frame, saves state, runs
+ * frames ahead with the latest input showing the last frame completed,
+ * then restores. Input is seen on screen frames earlier than it would be
+ * otherwise, at the cost of emulating frames + 1 frames per frame.
+ *
+ * Only the frames the shown one spans are rendered. With fewer frames
+ * ahead than Emulator::renderFrames() - 1 it may start before the real
+ * frame, the previous screen is then kept for a frame.
+ */
+class RunAhead {
+public:
+  RunAhead(u8 frames);
+
+  void setFrames(u8 frames);
+  u8 frames() const;
+
+  /**
+   * Advance emulator one frame and present the frame ahead of it
+   */
+  void nextFrame(Emulator &emulator);
+
+  /**
+   * Last frame breakdown
+   */
+  struct Timing {
+    std::chrono::nanoseconds emulate; // hidden frame
+    std::chrono::nanoseconds save;
+    std::chrono::nanoseconds ahead; // frames ahead, last ones rendered
+    std::chrono::nanoseconds restore;
+  };
+
+  const Timing &timing() const;
+
+private:
+  u8 frames_;
+  buffer_t state_;
+  Timing timing_;
+};
+
+} // namespace gbg
+
+#endif /* !RUNAHEAD_H */
@@ -0,0 +1,67 @@
+/*
+ * saveram.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef SAVERAM_H
+#define SAVERAM_H
+
+#include <string>
+
+#include "common.hpp"
+
+namespace gbg {
+
+/**
+ * Cartridge ram kept in a memory mapping
+ *
+ * Battery backed ram maps its save file shared, so writes land in the page
+ * cache as they happen and reach the disk without any save step. Other ram
+ * maps private anonymous memory that never touches the disk.
+ */
+class SaveRam {
+public:
+  SaveRam();
+  ~SaveRam();
+
+  SaveRam(const SaveRam &) = delete;
+  SaveRam &operator=(const SaveRam &) = delete;
+
+  /**
+   * Map the file at path, created or grown to size bytes and never shrunk,
+   * or size bytes of anonymous memory when path is empty, replaces the
+   * previous mapping
+   */
+  void map(const std::string &path, size_t size);
+
+  /**
+   * Flush and drop the mapping
+   */
+  void unmap();
+
+  /**
+   * Schedule the write back of changed pages to the file, wait blocks until
+   * it is done, no-op for anonymous memory
+   */
+  void flush(bool wait = false);
+
+  u8 *data() { return data_; }
+  const u8 *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  /**
+   * Backed by a file
+   */
+  bool persistent() const { return fd_ >= 0; }
+
+private:
+  u8 *data_;
+  size_t size_;
+  int fd_;
+};
+
+} // namespace gbg
+
+#endif /* !SAVERAM_H */
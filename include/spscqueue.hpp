@@ -0,0 +1,73 @@
+/*
+ * spscqueue.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+
+#include "common.hpp"
+
+namespace gbg {
+
+/**
+ * Wait-free bounded single producer single consumer queue
+ *
+ * Capacity must be a power of two.
+ */
+template <typename T, size_t Capacity> class SpscQueue {
+public:
+  static_assert((Capacity & (Capacity - 1)) == 0);
+
+  SpscQueue() : head_(0), tail_(0), items_() {}
+
+  /**
+   * Producer side, false when full
+   */
+  bool push(const T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    items_[tail & (Capacity - 1)] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side, false when empty
+   */
+  bool pop(T &item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = items_[head & (Capacity - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side, next item without removing it
+   */
+  const T *peek() const {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &items_[head & (Capacity - 1)];
+  }
+
+private:
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+  T items_[Capacity];
+};
+
+} // namespace gbg
+
+#endif /* !SPSCQUEUE_H */
@@ -0,0 +1,69 @@
+/*
+ * triplebuffer.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <array>
+#include <atomic>
+
+#include "common.hpp"
+
+namespace gbg {
+
+/**
+ * Lock-free triple buffer
+ *
+ * Single producer writes into back() and publishes it, single consumer
+ * picks the latest published value with update(). Neither side ever waits,
+ * values published faster than consumed are dropped.
+ */
+template <typename T> class TripleBuffer {
+public:
+  TripleBuffer() : slots_(), back_(0), middle_(1), front_(2) {}
+
+  /**
+   * Producer slot, exclusively owned until publish()
+   */
+  T &back() { return slots_[back_]; }
+
+  void publish() {
+    back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel) &
+            kIndexMask;
+  }
+
+  /**
+   * Consumer takes the latest published value, false if none since the
+   * last update
+   */
+  bool update() {
+    if ((middle_.load(std::memory_order_relaxed) & kFresh) == 0) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+    return true;
+  }
+
+  /**
+   * Consumer slot, exclusively owned until the next update()
+   */
+  const T &front() const { return slots_[front_]; }
+
+private:
+  static const u8 kIndexMask = 0x03;
+  static const u8 kFresh = 0x04;
+
+  std::array<T, 3> slots_;
+
+  u8 back_;
+  alignas(64) std::atomic<u8> middle_;
+  alignas(64) u8 front_;
+};
+
+} // namespace gbg
+
+#endif /* !TRIPLEBUFFER_H */
@@ -0,0 +1,116 @@
+/*
+ * vectorenv.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef VECTORENV_H
+#define VECTORENV_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+#include "emulator.hpp"
+
+namespace gbg {
+
+/**
+ * Reward term, scale times the change of the byte at addr over a step
+ */
+struct RewardTerm {
+  addr_t addr;
+  float scale;
+};
+
+/**
+ * Batch of emulators stepped together
+ *
+ * Every instance starts from the same reset state, forked copy-on-write.
+ * Steps are spread over a pool of worker threads that instances are handed
+ * out to one at a time, the only synchronization per batch is waking the
+ * workers and waiting for the last one to finish.
+ */
+class VectorEnv {
+public:
+  static const size_t kObservationSize =
+      Gpu::kScreenWidth * Gpu::kScreenHeight;
+
+  struct Config {
+    Model model = Model::DMG;
+    bool fastBoot = true;
+
+    std::string cartridgePath = "cartridge.gb";
+
+    // battery backed ram of the base instance, the forks keep anonymous
+    // copies, empty keeps every instance off the disk
+    std::string savePath;
+
+    // frames run per step, only the last one is rendered
+    u32 frameSkip = 4;
+
+    std::vector<RewardTerm> rewards;
+
+    // worker threads besides the caller, 0 uses one per core
+    size_t threads = 0;
+  };
+
+  VectorEnv(size_t count, const Config &config);
+  ~VectorEnv();
+
+  VectorEnv(const VectorEnv &) = delete;
+  VectorEnv &operator=(const VectorEnv &) = delete;
+
+  /**
+   * Press actions[i] (Button mask) on instance i and run frameSkip frames
+   *
+   * Observations is [count, kScreenHeight, kScreenWidth] shade indices, or
+   * nullptr to skip rendering. Rewards is [count], or nullptr. Steps end on
+   * vertical blank so observations always hold whole frames.
+   */
+  void step(const u8 *actions, u8 *observations, float *rewards);
+
+  /**
+   * Restore instance to the reset state
+   */
+  void reset(size_t index);
+  void reset();
+
+  size_t size() const;
+  Emulator &emulator(size_t index);
+
+private:
+  const Config config_;
+
+  Emulator base_;
+  buffer_t initial_;
+  std::vector<std::unique_ptr<Emulator>> emulators_;
+
+  // current batch
+  const u8 *actions_;
+  u8 *observations_;
+  float *rewards_;
+  std::atomic<size_t> next_;
+  std::atomic<size_t> pending_;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  u64 batch_;
+  bool quit_;
+  std::vector<std::thread> workers_;
+
+  void worker();
+  void run();
+  void stepOne(size_t index);
+};
+
+} // namespace gbg
+
+#endif /* !VECTORENV_H */
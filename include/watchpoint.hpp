@@ -0,0 +1,25 @@
+/*
+ * watchpoint.hpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef WATCHPOINT_H
+#define WATCHPOINT_H
+
+#include "common.hpp"
+
+namespace gbg {
+
+enum Watch : u8 { kWatchRead = 1 << 0, kWatchWrite = 1 << 1 };
+
+struct Watchpoint {
+  addr_t addr;
+  u8 kind;  // Watch flags
+  u8 value; // value of the last access that hit it
+};
+
+} // namespace gbg
+
+#endif /* !WATCHPOINT_H */
@@ -12,24 +12,93 @@
 #include "interrupt.hpp"
 #include "mmu.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <iomanip>
 #include <iostream>
 
 using namespace gbg;
 
-Cpu::Cpu(MMU &mmu) : regs(), mmu(mmu), iset_(512, &Cpu::notimpl) {
+Cpu::Cpu(MMU &mmu)
+    : regs(), mmu(mmu), iset_(512, &Cpu::notimpl), breakpoints_(),
+      stopped_(false), watched_(false), fetch_(nullptr), fetchBegin_(0),
+      fetchSize_(0), fetchGeneration_(mmu.generation()) {
   populateInstructionSets();
 }
 
+void Cpu::sync() {
+  if (fetchGeneration_ != mmu.generation()) {
+    // memory mapping changed, window may point to stale memory
+    fetchGeneration_ = mmu.generation();
+    fetchSize_ = 0;
+  }
+}
+
 ticks_t Cpu::cycle() {
+  sync();
+
+  addr_t offset = regs.pc - fetchBegin_;
+  if (offset >= fetchSize_ && !stopped_ &&
+      (mmu.trapped() || std::binary_search(breakpoints_.begin(),
+                                           breakpoints_.end(), regs.pc))) {
+    watched_ = mmu.trapped();
+    mmu.clearTrap();
+    stopped_ = true;
+    return 0;
+  }
+
+  stopped_ = false;
+  return execute();
+}
+
+ticks_t Cpu::step() {
+  sync();
+  stopped_ = false;
+  auto ticks = execute();
+  mmu.clearTrap();
+  return ticks;
+}
+
+bool Cpu::addBreakpoint(addr_t a) {
+  auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), a);
+  if (it != breakpoints_.end() && *it == a) {
+    return false;
+  }
+  breakpoints_.insert(it, a);
+  fetchSize_ = 0;
+  return true;
+}
+
+bool Cpu::removeBreakpoint(addr_t a) {
+  auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), a);
+  if (it == breakpoints_.end() || *it != a) {
+    return false;
+  }
+  breakpoints_.erase(it);
+  fetchSize_ = 0;
+  return true;
+}
+
+const std::vector<addr_t> &Cpu::breakpoints() const { return breakpoints_; }
+
+bool Cpu::stopped() const { return stopped_; }
+
+bool Cpu::watched() const { return watched_; }
+
+void Cpu::clearStop() {
+  stopped_ = false;
+  watched_ = false;
+}
+
+ticks_t Cpu::execute() {
   auto opcode = peek8();               // fetch
   auto instruction = iset_.at(opcode); // decode
   auto ticks = (this->*instruction)(); // execute
 
   // Interruption handler
   if (regs.ime) {
-    auto iflags = mmu.read(Address::HwIoInterruptFlags);
-    auto iswitch = mmu.read(Address::HwIoInterruptSwitch);
+    auto iflags = mmu.zread(Address::HwIoInterruptFlags & 0xff);
+    auto iswitch = mmu.zread(Address::HwIoInterruptSwitch & 0xff);
 
     if (iflags & iswitch) {
       regs.ime = 0;
@@ -57,24 +126,70 @@ ticks_t Cpu::cycle() {
         assert(false);
       }
 
-      mmu.write(Address::HwIoInterruptFlags, iflags);
+      mmu.zwrite(Address::HwIoInterruptFlags & 0xff, iflags);
     }
   }
 
   return ticks;
 }
 
-u8 Cpu::next8() { return read8(regs.pc++); }
+bool Cpu::refill(addr_t a) {
+  addr_t begin = 0;
+  addr_t end = 0;
+  fetch_ = mmu.window(a, begin, end);
+  if (fetch_ == nullptr) {
+    fetchSize_ = 0;
+    return false;
+  }
+
+  // shrink window to the breakpoints surrounding address
+  auto it = std::upper_bound(breakpoints_.begin(), breakpoints_.end(), a);
+  if (it != breakpoints_.end() && *it < end) {
+    end = *it;
+  }
+  if (it != breakpoints_.begin() && *(it - 1) >= begin) {
+    fetch_ += (*(it - 1) + 1) - begin;
+    begin = *(it - 1) + 1;
+  }
+
+  fetchBegin_ = begin;
+  fetchSize_ = begin < end ? end - begin : 0;
+  return static_cast<addr_t>(a - fetchBegin_) < fetchSize_;
+}
+
+u8 Cpu::fetch8(addr_t a) {
+  addr_t offset = a - fetchBegin_;
+  if (offset < fetchSize_) {
+    return fetch_[offset];
+  }
+
+  if (refill(a)) {
+    return fetch_[a - fetchBegin_];
+  }
+
+  return read8(a);
+}
+
+u8 Cpu::next8() { return fetch8(regs.pc++); }
 
 u16 Cpu::next16() {
-  auto data = read16(regs.pc);
+  auto data = peek16();
   regs.pc += 2;
   return data;
 }
 
-u8 Cpu::peek8() { return read8(regs.pc); }
+u8 Cpu::peek8() { return fetch8(regs.pc); }
+
+u16 Cpu::peek16() {
+  addr_t offset = regs.pc - fetchBegin_;
+  if (offset + 1 < fetchSize_) {
+    return (fetch_[offset + 1] << 8) | fetch_[offset];
+  }
 
-u16 Cpu::peek16() { return read16(regs.pc); }
+  u8 lsb = fetch8(regs.pc);
+  u8 hsb = fetch8(regs.pc + 1);
+  return (hsb << 8) | lsb;
+}
 
 u8 Cpu::read8(addr_t a) { return mmu.read(a); }
 
@@ -91,11 +206,11 @@ void Cpu::write16(addr_t a, u16 v) {
   mmu.write(a + 1, v & 0xff);
 }
 
-u8 Cpu::zread8(u8 a) { return read8(0xff00 + a); }
+u8 Cpu::zread8(u8 a) { return mmu.zread(a); }
 
 u16 Cpu::zread16(u8 a) { return read16(0xff00 + a); }
 
-void Cpu::zwrite8(u8 a, u8 v) { write8(0xff00 + a, v); }
+void Cpu::zwrite8(u8 a, u8 v) { mmu.zwrite(a, v); }
 
 void Cpu::zwrite16(u8 a, u16 v) { write16(0xff00 + a, v); }
 
@@ -111,18 +226,9 @@ void Cpu::rst(addr_t a) {
 
 void Cpu::ret() { pop(regs.pc); }
 
-void Cpu::push(u16 &reg) {
-  u8 hsb = reg >> 8;
-  u8 lsb = reg;
-  write8(regs.sp--, lsb);
-  write8(regs.sp--, hsb);
-}
+void Cpu::push(u16 &reg) { mmu.push(regs.sp, reg); }
 
-void Cpu::pop(u16 &reg) {
-  u8 hsb = read8(++regs.sp);
-  u8 lsb = read8(++regs.sp);
-  reg = (hsb << 8) | lsb;
-}
+void Cpu::pop(u16 &reg) { reg = mmu.pop(regs.sp); }
 
 ticks_t Cpu::notimpl() {
   std::stringstream ss;
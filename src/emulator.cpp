@@ -7,91 +7,373 @@
 
 #include "emulator.hpp"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <exception>
+#include <fstream>
+#include <memory>
 
 #include <SFML/System/FileInputStream.hpp>
 
 using namespace gbg;
 
 Emulator::Emulator(u8 fps)
-    : mmu_(), gpu_(mmu_), cpu_(mmu_), counter_(0),
-      frameDuration_(kClockRate / fps) {}
+    : mmu_(), gpu_(mmu_), cpu_(mmu_), counter_(0), cycles_(0), fps_(fps),
+      frameDuration_(kClockRate / fps), publishedCycles_(0), joypad_(),
+      nextJoypad_(0), joypadReplay_(), joypadLog_(), joypadRecording_(false),
+      cartridgePath_("cartridge.gb"), savePath_("cartridge.sav") {}
 
-void Emulator::reset() {
-  {
-    sf::FileInputStream file;
+static buffer_t loadFile(const char *path, const char *error) {
+  sf::FileInputStream file;
 
-    if (!file.open("bios.bin")) {
-      throw std::runtime_error("error: cannot load bios");
+  if (!file.open(path)) {
+    throw std::runtime_error(error);
+  }
+
+  buffer_t data(file.getSize(), 0xff);
+  file.read(data.data(), data.size());
+  return data;
+}
+
+void Emulator::reset(Model model, bool fastBoot) {
+  mmu_.reset();
+  gpu_.reset();
+  cpu_.regs = Registers();
+  counter_ = 0;
+  cycles_ = 0;
+  publishedCycles_.store(0, std::memory_order_relaxed);
+  nextJoypad_ = 0;
+  joypadReplay_.clear();
+  joypadLog_.clear();
+  joypadRecording_ = false;
+
+  auto cartridge =
+      loadFile(cartridgePath_.c_str(), "error: cannot load cartridge");
+  mmu_.loadCartridge(cartridge, savePath_);
+
+  if (fastBoot) {
+    mmu_.skipBios(model);
+
+    auto &r = cpu_.regs;
+    if (model == Model::SGB) {
+      r.af = 0x0100;
+      r.bc = 0x0014;
+      r.de = 0x0000;
+      r.hl = 0xc060;
+    } else {
+      r.af = 0x01b0;
+      r.bc = 0x0013;
+      r.de = 0x00d8;
+      r.hl = 0x014d;
     }
+    r.sp = 0xfffe;
+    r.pc = 0x0100;
+    return;
+  }
+
+  if (model == Model::SGB) {
+    mmu_.loadBios(loadFile("sgb_bios.bin", "error: cannot load bios"));
+    return;
+  }
 
-    buffer_t bios(file.getSize(), 0xff);
-    file.read(bios.data(), bios.size());
+  auto bios = loadFile("bios.bin", "error: cannot load bios");
 
-    mmu_.loadBios(bios);
+  const size_t blogo = 0x00a8;
+  const size_t clogo = 0x0104;
+  const size_t logoSize = 48;
+  if (cartridge.size() < clogo + logoSize ||
+      !std::equal(bios.begin() + blogo, bios.begin() + blogo + logoSize,
+                  cartridge.begin() + clogo)) {
+    throw std::runtime_error("error: logo mismatch");
   }
 
-  {
-    sf::FileInputStream file;
+  mmu_.loadBios(bios);
+}
 
-    if (!file.open("cartridge.gb")) {
-      throw std::runtime_error("error: cannot load cartridge");
-    }
+static_assert(std::is_trivially_copyable<Emulator::State>::value,
+              "state must be saved/restored with plain copies");
 
-    buffer_t cartridge(file.getSize(), 0xff);
-    file.read(cartridge.data(), cartridge.size());
+static const u32 kStateMagic = 0x53474247; // GBGS
 
-    mmu_.loadCartridge(cartridge);
+size_t Emulator::stateSize() const {
+  return sizeof(State) + mmu_.cartridgeRamSize();
+}
+
+void Emulator::save(buffer_t &data) const {
+  data.resize(stateSize());
+  State &state = *reinterpret_cast<State *>(data.data());
+
+  // Field by field over zeros, struct copies carry padding bytes that are
+  // never initialized and equal machines must save equal bytes
+  std::memset(data.data(), 0, offsetof(State, mmu));
+  state.version = kStateVersion;
+  state.regs.af = cpu_.regs.af;
+  state.regs.bc = cpu_.regs.bc;
+  state.regs.de = cpu_.regs.de;
+  state.regs.hl = cpu_.regs.hl;
+  state.regs.sp = cpu_.regs.sp;
+  state.regs.pc = cpu_.regs.pc;
+  state.regs.ime = cpu_.regs.ime;
+  state.gpu.scanline = gpu_.state().scanline;
+  state.gpu.counter = gpu_.state().counter;
+  state.counter = counter_;
+  state.cycles = cycles_;
+  mmu_.save(state.mmu, data.data() + sizeof(State));
+}
+
+void Emulator::load(const buffer_t &data) {
+  const State &state = *reinterpret_cast<const State *>(data.data());
+  if (data.size() < sizeof(State) || state.version != kStateVersion) {
+    throw std::runtime_error("error: incompatible state version");
+  }
+  if (data.size() != stateSize()) {
+    throw std::runtime_error("error: state of another cartridge");
   }
 
-  addr_t blogo = 0x00a8;
-  addr_t clogo = 0x0104;
-  for (addr_t i = 0; i < 48; i++) {
-    auto bdata = mmu_.read(blogo + i);
-    auto cdata = mmu_.read(clogo + i);
-    if (bdata != cdata) {
-      throw std::runtime_error("error: logo mismatch");
-    }
+  cpu_.regs = state.regs;
+  gpu_.restore(state.gpu);
+  counter_ = state.counter;
+  cycles_ = state.cycles;
+  publishedCycles_.store(cycles_, std::memory_order_relaxed);
+  nextJoypad_ = 0;
+  mmu_.restore(state.mmu, data.data() + sizeof(State));
+  cpu_.clearStop();
+}
+
+void Emulator::saveState(const std::string &path) const {
+  buffer_t state;
+  save(state);
+
+  std::ofstream file(path, std::ios::binary);
+  u32 header[2] = {kStateMagic, static_cast<u32>(state.size())};
+  file.write(reinterpret_cast<const char *>(header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(state.data()), state.size());
+
+  if (!file) {
+    throw std::runtime_error("error: cannot write state");
   }
 }
 
-MMU &Emulator::getMMU() { return mmu_; }
+void Emulator::loadState(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+
+  u32 header[2] = {0, 0};
+  file.read(reinterpret_cast<char *>(header), sizeof(header));
+  if (!file || header[0] != kStateMagic || header[1] != stateSize()) {
+    throw std::runtime_error("error: invalid state file");
+  }
+
+  buffer_t state(header[1]);
+  file.read(reinterpret_cast<char *>(state.data()), state.size());
+  if (!file) {
+    throw std::runtime_error("error: truncated state file");
+  }
+
+  load(state);
+}
+
+std::unique_ptr<Emulator> Emulator::fork() {
+  std::unique_ptr<Emulator> child(new Emulator(fps_));
+  mmu_.fork(child->mmu_);
+  child->gpu_.restore(gpu_.state());
+  child->cpu_.regs = cpu_.regs;
+  child->counter_ = counter_;
+  child->cycles_ = cycles_;
+  child->publishedCycles_.store(cycles_, std::memory_order_relaxed);
+  child->cartridgePath_ = cartridgePath_;
+  // cartridge ram of the child is never written back to the save file
+  child->savePath_.clear();
+  return child;
+}
+
+MMUImpl &Emulator::getMMU() { return mmu_; }
 
 Registers &Emulator::getRegisters() { return cpu_.regs; }
 
 void Emulator::render(sf::RenderTarget &renderer) { gpu_.render(renderer); }
 
-void Emulator::nextFrame() {
-  while (counter_ < frameDuration_) {
+void Emulator::setCartridgePath(const std::string &path) {
+  cartridgePath_ = path;
+
+  // rom extension replaced, when the dot is in the file name
+  auto dot = path.rfind('.');
+  auto slash = path.rfind('/');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    dot = path.size();
+  }
+  savePath_ = path.substr(0, dot) + ".sav";
+}
+
+void Emulator::setSavePath(const std::string &path) { savePath_ = path; }
+
+void Emulator::flushSaveRam(bool wait) { mmu_.flushSaveRam(wait); }
+
+void Emulator::setRtcClock(RtcClock clock) { mmu_.setRtcClock(clock); }
+
+void Emulator::setRendering(bool enabled) { gpu_.setRendering(enabled); }
+
+u32 Emulator::renderFrames() const {
+  // two lcd frames plus the instructions frames overrun by
+  return (2 * Gpu::kFrameDuration + kScanlineDuration) / frameDuration_ + 1;
+}
+
+void Emulator::setShadeOutput(u8 *shades) { gpu_.setShadeOutput(shades); }
+
+const buffer_t &Emulator::screen() const { return gpu_.screen(); }
+
+void Emulator::setButtons(u8 buttons) { mmu_.setButtons(buttons); }
+
+Emulator::JoypadQueue &Emulator::joypad() { return joypad_; }
+
+void Emulator::recordJoypad() {
+  joypadLog_.clear();
+  joypadRecording_ = true;
+}
+
+void Emulator::replayJoypad() {
+  // replayed events left, if any, come after the ones just applied
+  joypadReplay_.insert(joypadReplay_.begin(), joypadLog_.begin(),
+                       joypadLog_.end());
+  joypadLog_.clear();
+  joypadRecording_ = false;
+  nextJoypad_ = 0;
+}
+
+ticks_t Emulator::cycles() const {
+  return publishedCycles_.load(std::memory_order_relaxed);
+}
+
+void Emulator::pollJoypad() {
+  publishedCycles_.store(cycles_, std::memory_order_relaxed);
+
+  while (!joypadReplay_.empty() && joypadReplay_.front().cycle <= cycles_) {
+    applyJoypad(joypadReplay_.front());
+    joypadReplay_.pop_front();
+  }
+  if (!joypadReplay_.empty()) {
+    // the queue only holds events queued after them
+    nextJoypad_ = joypadReplay_.front().cycle;
+    return;
+  }
+
+  JoypadEvent applied = JoypadEvent();
+  auto event = joypad_.peek();
+  while (event && event->cycle <= cycles_) {
+    joypad_.pop(applied);
+    applyJoypad(applied);
+    event = joypad_.peek();
+  }
+  nextJoypad_ = event ? event->cycle : cycles_ + kScanlineDuration;
+}
+
+void Emulator::applyJoypad(const JoypadEvent &event) {
+  mmu_.setButtons(event.buttons);
+  if (joypadRecording_) {
+    // replayed on the instruction it was applied on, late events included
+    joypadLog_.push_back({cycles_, event.buttons});
+  }
+}
+
+template <typename Stop> ticks_t Emulator::run(ticks_t limit, Stop stop) {
+  ticks_t elapsed = 0;
+  while (elapsed < limit) {
+    if (cycles_ >= nextJoypad_) {
+      pollJoypad();
+    }
+
     auto t = cpu_.cycle();
 
     if (t == 0) {
-      // halt
-      return;
+      // breakpoint or watchpoint
+      break;
     }
 
     mmu_.step(t);
     gpu_.step(t);
 
-    counter_ += t;
+    elapsed += t;
+    cycles_ += t;
 
-    if (cpu_.regs.pc == 0x027e) {
-      return;
+    if (stop()) {
+      break;
     }
   }
-  counter_ -= frameDuration_;
+  publishedCycles_.store(cycles_, std::memory_order_relaxed);
+  return elapsed;
 }
 
-ticks_t Emulator::nextTicks() {
-  auto t = cpu_.cycle();
+void Emulator::nextFrame() {
+  counter_ += runFor(frameDuration_ - counter_);
+  if (counter_ >= frameDuration_) {
+    counter_ -= frameDuration_;
+  }
+}
 
-  if (t == 0) {
-    // halt
-    return 0;
+ticks_t Emulator::nextTicks() {
+  if (cycles_ >= nextJoypad_) {
+    pollJoypad();
   }
 
+  auto t = cpu_.step();
+
   mmu_.step(t);
   gpu_.step(t);
+  cycles_ += t;
+  publishedCycles_.store(cycles_, std::memory_order_relaxed);
 
   return t;
 }
+
+ticks_t Emulator::runFor(ticks_t ticks) {
+  return run(ticks, [] { return false; });
+}
+
+bool Emulator::runUntilFrame() {
+  // Runs end on the instruction that reaches the vertical blank, nothing
+  // is checked per instruction. A scanline reset only pushes it later.
+  const u64 frame = gpu_.frame();
+  while (gpu_.frame() == frame) {
+    ticks_t ticks = gpu_.ticksToFrame();
+    if (runFor(ticks) < ticks) {
+      break;
+    }
+  }
+  return !cpu_.stopped();
+}
+
+bool Emulator::runUntil(addr_t pc, ticks_t limit) {
+  bool added = cpu_.addBreakpoint(pc);
+  run(limit, [] { return false; });
+  if (added) {
+    cpu_.removeBreakpoint(pc);
+  }
+  return cpu_.stopped() && cpu_.regs.pc == pc;
+}
+
+bool Emulator::stopped() const { return cpu_.stopped(); }
+
+bool Emulator::addBreakpoint(addr_t pc) { return cpu_.addBreakpoint(pc); }
+
+bool Emulator::removeBreakpoint(addr_t pc) { return cpu_.removeBreakpoint(pc); }
+
+const std::vector<addr_t> &Emulator::breakpoints() const {
+  return cpu_.breakpoints();
+}
+
+void Emulator::addWatchpoint(addr_t addr, u8 kind) {
+  mmu_.addWatchpoint(addr, kind);
+}
+
+bool Emulator::removeWatchpoint(addr_t addr) {
+  return mmu_.removeWatchpoint(addr);
+}
+
+const std::vector<Watchpoint> &Emulator::watchpoints() const {
+  return mmu_.watchpoints();
+}
+
+const Watchpoint *Emulator::watchHit() const {
+  return (cpu_.stopped() && cpu_.watched()) ? &mmu_.watchHit() : nullptr;
+}
@@ -0,0 +1,272 @@
+/*
+ * emulatorthread.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "emulatorthread.hpp"
+#include "address.hpp"
+#include "alu.hpp"
+#include "log.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <exception>
+
+using namespace gbg;
+using namespace std::chrono;
+
+static const char *kQuickState = "quick.state";
+
+EmulatorThread::EmulatorThread(const std::string &cartridgePath, u8 fps,
+                               Model model, bool fastBoot, u8 runAheadFrames,
+                               float saveInterval, RtcClock rtc,
+                               const std::string &recordPath)
+    : emulator_(fps), rewind_(16 * 1024 * 1024, 2), runAhead_(runAheadFrames),
+      pacer_(fps), movie_(), recordPath_(recordPath), inputs_(), snapshots_(),
+      quit_(false), running_(true), fastForward_(false), rewinding_(false),
+      speed_(4.0f), frameSkip_(8), pendingFrames_(0), buttons_(0),
+      emulatedFrames_(0), emulatedFps_(0),
+      saveInterval_(saveInterval), error_(), thread_() {
+  // Reset here so that load errors reach the caller
+  emulator_.setCartridgePath(cartridgePath);
+  emulator_.setRtcClock(rtc);
+  emulator_.reset(model, fastBoot);
+  emulator_.addBreakpoint(0x027e);
+  if (!recordPath_.empty()) {
+    movie_.record(emulator_);
+  }
+
+  publish();
+  thread_ = std::thread(&EmulatorThread::loop, this);
+}
+
+EmulatorThread::~EmulatorThread() { stop(); }
+
+void EmulatorThread::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+
+  quit_.store(true, std::memory_order_relaxed);
+  thread_.join();
+  emulator_.flushSaveRam(true);
+
+  if (!recordPath_.empty()) {
+    try {
+      movie_.save(recordPath_);
+    } catch (const std::exception &e) {
+      GBG_LOG(kLogError, kLogApp, emulator_.cycles(), "{}", e.what());
+    }
+  }
+}
+
+bool EmulatorThread::send(const Input &input) { return inputs_.push(input); }
+
+bool EmulatorThread::update() { return snapshots_.update(); }
+
+const Snapshot &EmulatorThread::snapshot() const {
+  return snapshots_.front();
+}
+
+void EmulatorThread::vsync() { pacer_.vsync(); }
+
+void EmulatorThread::loop() {
+  auto fpsTs = steady_clock::now();
+  auto saveTs = fpsTs;
+
+  while (!quit_.load(std::memory_order_relaxed)) {
+    bool changed = false;
+
+    Input input;
+    while (inputs_.pop(input)) {
+      apply(input);
+      changed = true;
+    }
+
+    if (running_) {
+      runFrame();
+      changed = true;
+    }
+
+    auto elapsed = steady_clock::now() - fpsTs;
+    if (elapsed >= milliseconds(500)) {
+      emulatedFps_ = emulatedFrames_ / duration<float>(elapsed).count();
+      emulatedFrames_ = 0;
+      fpsTs = steady_clock::now();
+      changed = true;
+    }
+
+    if (changed) {
+      publish();
+    }
+
+    // save ram writes are already in the page cache, this only hurries
+    // the write back
+    if (steady_clock::now() - saveTs >= duration<float>(saveInterval_)) {
+      emulator_.flushSaveRam();
+      saveTs = steady_clock::now();
+    }
+
+    if (running_ && fastForward_ && speed_ <= 0) {
+      pacer_.mark();
+    } else {
+      pacer_.wait();
+    }
+  }
+}
+
+void EmulatorThread::apply(const Input &input) {
+  switch (input.kind) {
+  case kInputToggleRun:
+    running_ = !running_;
+    break;
+  case kInputStep:
+    // the movie records whole frames only
+    if (recordPath_.empty()) {
+      emulator_.nextTicks();
+    }
+    break;
+  case kInputToggleZero:
+    emulator_.getRegisters().f ^= alu::kFZ;
+    break;
+  case kInputSaveState:
+  case kInputLoadState:
+    try {
+      if (input.kind == kInputSaveState) {
+        emulator_.saveState(kQuickState);
+      } else if (recordPath_.empty()) {
+        emulator_.loadState(kQuickState);
+        rewind_.clear();
+      }
+      error_.clear();
+    } catch (const std::exception &e) {
+      error_ = e.what();
+    }
+    break;
+  case kInputAddBreakpoint:
+    emulator_.addBreakpoint(input.addr);
+    break;
+  case kInputRemoveBreakpoint:
+    emulator_.removeBreakpoint(input.addr);
+    break;
+  case kInputAddWatchpoint:
+    emulator_.addWatchpoint(input.addr, input.flags);
+    break;
+  case kInputRemoveWatchpoint:
+    emulator_.removeWatchpoint(input.addr);
+    break;
+  case kInputFastForward:
+    fastForward_ = input.flags != 0;
+    break;
+  case kInputRewind:
+    rewinding_ = input.flags != 0 && recordPath_.empty();
+    break;
+  case kInputSpeed:
+    speed_ = input.value;
+    break;
+  case kInputFrameSkip:
+    frameSkip_ = std::max(1, static_cast<int>(input.value));
+    break;
+  case kInputPacing:
+    pacer_.setPacing(static_cast<Pacing>(input.flags));
+    break;
+  case kInputButtons:
+    // at the frame boundary, before run-ahead saves the state to roll back
+    emulator_.setButtons(input.flags);
+    buttons_ = input.flags;
+    break;
+  }
+}
+
+void EmulatorThread::runFrame() {
+  if (rewinding_) {
+    rewind_.step(emulator_);
+    return;
+  }
+
+  if (fastForward_) {
+    // Only the frames the last completed one spans are rendered
+    int frames = frameSkip_;
+    if (speed_ > 0) {
+      pendingFrames_ += speed_;
+      frames = static_cast<int>(pendingFrames_);
+      pendingFrames_ -= frames;
+    }
+
+    const int render = emulator_.renderFrames();
+    for (int i = 1; i <= frames; i++) {
+      emulator_.setRendering(frames - i < render);
+      nextFrame();
+      rewind_.capture(emulator_);
+      emulatedFrames_ += 1;
+      if (emulator_.stopped()) {
+        break;
+      }
+    }
+    emulator_.setRendering(true);
+  } else {
+    if (recordPath_.empty()) {
+      runAhead_.nextFrame(emulator_);
+    } else {
+      nextFrame();
+    }
+    rewind_.capture(emulator_);
+    emulatedFrames_ += 1;
+  }
+
+  if (emulator_.stopped()) {
+    running_ = false;
+  }
+}
+
+void EmulatorThread::nextFrame() {
+  if (recordPath_.empty()) {
+    emulator_.nextFrame();
+  } else {
+    movie_.recordFrame(emulator_, buttons_);
+  }
+}
+
+void EmulatorThread::publish() {
+  Snapshot &s = snapshots_.back();
+  auto &mmu = emulator_.getMMU();
+
+  s.screen = emulator_.screen();
+
+  s.regs = emulator_.getRegisters();
+  for (size_t i = 0; i < s.io.size(); i++) {
+    s.io[i] = mmu.load(MemAddr::kHwIO + i);
+  }
+  s.ie = mmu.load(Address::HwIoInterruptSwitch);
+
+  for (size_t i = 0; i < s.code.size(); i++) {
+    s.code[i] = mmu.load(s.regs.pc + i);
+  }
+
+  s.running = running_;
+  s.stopped = emulator_.stopped();
+  auto hit = emulator_.watchHit();
+  s.watched = hit != nullptr;
+  s.watchHit = hit ? *hit : Watchpoint();
+  s.breakpoints = emulator_.breakpoints();
+  s.watchpoints = emulator_.watchpoints();
+
+  s.emulatedFps = emulatedFps_;
+
+  s.pacing = pacer_.pacing();
+  s.frameTimes = pacer_.stats();
+  s.refreshRate = pacer_.refreshRate();
+
+  s.runAheadFrames = runAhead_.frames();
+  s.runAhead = runAhead_.timing();
+
+  s.rewindFrames = rewind_.frames();
+  s.rewindUsed = rewind_.used();
+  s.rewindBytesPerMinute = rewind_.bytesPerMinute();
+
+  s.error = error_;
+
+  snapshots_.publish();
+}
@@ -13,8 +13,10 @@
 #include "sprite.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <deque>
 #include <sstream>
+#include <utility>
 
 using namespace gbg;
 
@@ -24,8 +26,8 @@ static const u8 kTileHeight = 8;
 static const u8 kTilesPerRow = 32;
 static const u8 kTilesPerColumn = 32;
 
-static const size_t kDisplayWidth = 160;
-static const size_t kDisplayHeight = 144;
+static const size_t kDisplayWidth = Gpu::kScreenWidth;
+static const size_t kDisplayHeight = Gpu::kScreenHeight;
 static const size_t kDisplaySize = kDisplayWidth * kDisplayHeight;
 
 static const u8 kVerticalBlankScanline = 143;
@@ -67,9 +69,11 @@ static const u8 kModeMask = 0x3;
 } // namespace StatusFlags
 
 Gpu::Gpu(MMUImpl &mmu)
-    : mmu_(mmu), mode_(Mode::kVerticalBlank), scanline_(0), counter_(0),
-      palette_(), pixels_(kDisplaySize * kColorComponentSize, 0), texture_(),
-      viewport_() {
+    : mmu_(mmu), mode_(Mode::kVerticalBlank), state_(), frame_(0),
+      rendering_(true), complete_(true), palette_(),
+      pixels_(kDisplaySize * kColorComponentSize, 0), screen_(),
+      shades_(nullptr),
+      uploaded_(false), texture_(), viewport_() {
 
   // #9BBC0FFF (RGBA)
   palette_[0][0] = 0x9B;
@@ -95,32 +99,43 @@ Gpu::Gpu(MMUImpl &mmu)
   palette_[3][2] = 0x0F;
   palette_[3][3] = 0xFF;
 
-  for (u8 line = 0; line < kDisplayHeight; line++) {
-    clearScanline(line);
+  for (addr_t addr : {Address::HwIoLcdStatus, Address::HwIoCurrentScanline,
+                      Address::HwIoComparisonScanline}) {
+    mmu_.setIoHandler(addr - MemAddr::kHwIO,
+                      MMUImpl::ioHandler<Gpu, &Gpu::readIo, &Gpu::writeIo>(
+                          this));
   }
 
-  texture_.reset(new sf::Texture());
-  texture_->create(kDisplayWidth, kDisplayHeight);
-  texture_->update(pixels_.data());
+  reset();
+}
 
-  viewport_.reset(new sf::Sprite(*texture_));
+void Gpu::reset() {
+  mode_ = Mode::kVerticalBlank;
+  state_.scanline = 0;
+  state_.counter = 0;
+  complete_ = true;
 
-  mmu_.write(Address::HwIoScrollX, 0);
-  mmu_.write(Address::HwIoScrollY, 0);
-  mmu_.write(Address::HwIoCurrentScanline, 0);
-  mmu_.write(Address::HwIoComparisonScanline, 0);
-  mmu_.write(Address::HwIoLcdStatus,
-             mode_ | StatusFlags::kScanlineCoincidenceFlag);
-  mmu_.write(Address::HwIoLcdControl, 0);
+  for (u8 line = 0; line < kDisplayHeight; line++) {
+    clearScanline(line);
+  }
+  screen_ = pixels_;
+  uploaded_ = false;
+
+  io(Address::HwIoScrollX) = 0;
+  io(Address::HwIoScrollY) = 0;
+  io(Address::HwIoCurrentScanline) = 0;
+  io(Address::HwIoComparisonScanline) = 0;
+  io(Address::HwIoLcdStatus) = mode_ | StatusFlags::kScanlineCoincidenceFlag;
+  io(Address::HwIoLcdControl) = 0;
 }
 
 void Gpu::step(ticks_t t) {
-  counter_ += t;
+  state_.counter += t;
 
   switch (getMode()) {
   case Mode::kHorizontalBlank:
-    if (counter_ >= Duration::kHorizontalBlank) {
-      counter_ -= Duration::kHorizontalBlank;
+    if (state_.counter >= Duration::kHorizontalBlank) {
+      state_.counter -= Duration::kHorizontalBlank;
 
       auto scanline = getScanline();
       scanline += 1;
@@ -129,16 +144,26 @@ void Gpu::step(ticks_t t) {
       if (scanline >= kVerticalBlankScanline) {
         setMode(Mode::kVerticalBlank);
 
-        renderScanline();
-        texture_->update(pixels_.data());
+        if (rendering_) {
+          renderScanline();
+        } else {
+          complete_ = false;
+        }
+        if (complete_ && !shades_) {
+          // every line is rendered again before the next frame completes
+          std::swap(pixels_, screen_);
+          uploaded_ = false;
+        }
+        complete_ = true;
+        frame_ += 1;
       } else {
         setMode(Mode::kReadOAM);
       }
     }
     break;
   case Mode::kVerticalBlank:
-    if (counter_ >= Duration::kVerticalBlank) {
-      counter_ -= Duration::kVerticalBlank;
+    if (state_.counter >= Duration::kVerticalBlank) {
+      state_.counter -= Duration::kVerticalBlank;
 
       auto scanline = getScanline();
       scanline += 1;
@@ -151,82 +176,162 @@ void Gpu::step(ticks_t t) {
     }
     break;
   case Mode::kReadOAM:
-    if (counter_ >= Duration::kReadOAM) {
-      counter_ -= Duration::kReadOAM;
+    if (state_.counter >= Duration::kReadOAM) {
+      state_.counter -= Duration::kReadOAM;
       setMode(Mode::kWriteToVRAM);
     }
     break;
   case Mode::kWriteToVRAM:
-    if (counter_ >= Duration::kWriteToVRAM) {
-      counter_ -= Duration::kWriteToVRAM;
+    if (state_.counter >= Duration::kWriteToVRAM) {
+      state_.counter -= Duration::kWriteToVRAM;
       setMode(Mode::kHorizontalBlank);
-      renderScanline();
+      if (rendering_) {
+        renderScanline();
+      } else {
+        complete_ = false;
+      }
     }
     break;
   }
 }
 
-void Gpu::render(sf::RenderTarget &renderer) { renderer.draw(*viewport_); }
+void Gpu::render(sf::RenderTarget &renderer) {
+  // Created on first use, emulation itself never touches graphics resources
+  if (!texture_) {
+    texture_.reset(new sf::Texture());
+    texture_->create(kDisplayWidth, kDisplayHeight);
+    viewport_.reset(new sf::Sprite(*texture_));
+  }
+
+  if (!uploaded_) {
+    texture_->update(screen_.data());
+    uploaded_ = true;
+  }
+  renderer.draw(*viewport_);
+}
+
+const buffer_t &Gpu::screen() const { return screen_; }
+
+u64 Gpu::frame() const { return frame_; }
+
+ticks_t Gpu::ticksToFrame() {
+  // vertical blank is entered at the end of the last visible scanline
+  const ticks_t line = Duration::kReadOAM + Duration::kWriteToVRAM +
+                       Duration::kHorizontalBlank;
+  const ticks_t visible = kVerticalBlankScanline * line;
+  const ticks_t scanline = getScanline();
+
+  switch (getMode()) {
+  case Mode::kReadOAM:
+    return visible - scanline * line - state_.counter;
+  case Mode::kWriteToVRAM:
+    return visible - scanline * line - Duration::kReadOAM - state_.counter;
+  case Mode::kHorizontalBlank:
+    return visible - scanline * line - Duration::kReadOAM -
+           Duration::kWriteToVRAM - state_.counter;
+  default:
+    return (kReadObjectAttributeMemoryScanline + 1 - scanline) *
+               Duration::kVerticalBlank -
+           state_.counter + visible;
+  }
+}
+
+void Gpu::setRendering(bool enabled) { rendering_ = enabled; }
+
+void Gpu::setShadeOutput(u8 *shades) { shades_ = shades; }
+
+const Gpu::State &Gpu::state() const { return state_; }
 
-u8 Gpu::getMode() { return (mmu_.read(Address::HwIoLcdStatus) & 0x3); }
+void Gpu::restore(const State &state) {
+  state_ = state;
+  // lines drawn so far belong to another timeline
+  complete_ = false;
+}
+
+u8 Gpu::getMode() { return (io(Address::HwIoLcdStatus) & 0x3); }
 
 void Gpu::setMode(u8 mode) {
-  u8 status = mmu_.read(Address::HwIoLcdStatus);
+  u8 status = io(Address::HwIoLcdStatus);
   if (mode == Mode::kVerticalBlank) {
-    auto flags = mmu_.read(Address::HwIoInterruptFlags);
+    auto flags = io(Address::HwIoInterruptFlags);
     flags |= kLcdVerticalBlankingInterrupt;
     if (status & StatusFlags::kInterruptOnVerticalBlanking) {
       flags |= kLcdControllerInterrupt;
     }
-    mmu_.write(Address::HwIoInterruptFlags, flags);
+    io(Address::HwIoInterruptFlags) = flags;
   } else if (mode == Mode::kHorizontalBlank &&
              (status & StatusFlags::kInterruptOnHorizontalBlanking)) {
-    auto flags = mmu_.read(Address::HwIoInterruptFlags);
+    auto flags = io(Address::HwIoInterruptFlags);
     flags |= kLcdControllerInterrupt;
-    mmu_.write(Address::HwIoInterruptFlags, flags);
+    io(Address::HwIoInterruptFlags) = flags;
   } else if (mode == Mode::kReadOAM &&
              (status & StatusFlags::kInterruptOnReadOAM)) {
-    auto flags = mmu_.read(Address::HwIoInterruptFlags);
+    auto flags = io(Address::HwIoInterruptFlags);
     flags |= kLcdControllerInterrupt;
-    mmu_.write(Address::HwIoInterruptFlags, flags);
+    io(Address::HwIoInterruptFlags) = flags;
   }
 
   status = mode | (status & ~StatusFlags::kModeMask);
-  mmu_.write(Address::HwIoLcdStatus, status);
+  io(Address::HwIoLcdStatus) = status;
 }
 
-u8 Gpu::getScanline() {
-  auto scanline = mmu_.read(Address::HwIoCurrentScanline);
-  if (scanline_ != scanline) {
-    scanline = 0;
-    scanline_ = 0;
-  }
-  return scanline;
-}
+u8 Gpu::getScanline() { return state_.scanline; }
 
 void Gpu::setScanline(u8 scanline) {
-  scanline_ = scanline;
+  state_.scanline = scanline;
+
+  auto status = compareScanline();
+
+  if (status & StatusFlags::kInterruptOnScanlineCoincidence) {
+    io(Address::HwIoInterruptFlags) |= kLcdControllerInterrupt;
+  }
 
-  auto status = mmu_.read(Address::HwIoLcdStatus);
-  auto comparisonScanline = mmu_.read(Address::HwIoComparisonScanline);
+  io(Address::HwIoCurrentScanline) = scanline;
+  io(Address::HwIoLcdStatus) = status;
+}
 
-  if (scanline == comparisonScanline) {
+u8 Gpu::compareScanline() {
+  auto status = io(Address::HwIoLcdStatus);
+  if (state_.scanline == io(Address::HwIoComparisonScanline)) {
     status |= StatusFlags::kScanlineCoincidenceFlag;
   } else {
     status &= ~StatusFlags::kScanlineCoincidenceFlag;
   }
+  return status;
+}
 
-  if (status & StatusFlags::kInterruptOnScanlineCoincidence) {
-    mmu_.write(Address::HwIoInterruptFlags,
-               mmu_.read(Address::HwIoInterruptFlags) |
-                   kLcdControllerInterrupt);
-  }
+u8 &Gpu::io(addr_t addr) { return mmu_.io(addr - MemAddr::kHwIO); }
+
+u8 Gpu::readIo(u8 index) { return mmu_.io(index); }
 
-  mmu_.write(Address::HwIoCurrentScanline, scanline);
-  mmu_.write(Address::HwIoLcdStatus, status);
+void Gpu::writeIo(u8 index, u8 value) {
+  switch (index + MemAddr::kHwIO) {
+  case Address::HwIoLcdStatus:
+    // mode and coincidence are read only
+    mmu_.io(index) = (value & ~0x07) | (mmu_.io(index) & 0x07);
+    break;
+  case Address::HwIoCurrentScanline:
+    // writing restarts the scanline counter
+    state_.scanline = 0;
+    mmu_.io(index) = 0;
+    io(Address::HwIoLcdStatus) = compareScanline();
+    break;
+  case Address::HwIoComparisonScanline:
+    mmu_.io(index) = value;
+    io(Address::HwIoLcdStatus) = compareScanline();
+    break;
+  default:
+    mmu_.io(index) = value;
+    break;
+  }
 }
 
 void Gpu::clearScanline(u8 scanline) {
+  if (shades_) {
+    std::memset(shades_ + scanline * kDisplayWidth, 0, kDisplayWidth);
+    return;
+  }
+
   size_t begin = scanline * kDisplayWidth * kColorComponentSize;
   size_t end = begin + kDisplayWidth * kColorComponentSize;
   for (size_t i = begin; i < end; i += kColorComponentSize) {
@@ -237,7 +342,7 @@ void Gpu::clearScanline(u8 scanline) {
 }
 
 bool Gpu::isBackgroundEnable() {
-  return mmu_.read(Address::HwIoLcdControl) &
+  return io(Address::HwIoLcdControl) &
          ControlFlags::kBackgroundDisplayEnable;
 }
 
@@ -254,7 +359,7 @@ addr_t Gpu::getTileDataIndex(u8 line, u8 index) {
 }
 
 addr_t Gpu::getTileDataAddr() {
-  const u8 control = mmu_.read(Address::HwIoLcdControl);
+  const u8 control = io(Address::HwIoLcdControl);
   if (control & ControlFlags::kBackgroundWindowTileDataSelect) {
     return 0x8000;
   }
@@ -262,16 +367,16 @@ addr_t Gpu::getTileDataAddr() {
 }
 
 addr_t Gpu::getTileMapAddr() {
-  const u8 control = mmu_.read(Address::HwIoLcdControl);
+  const u8 control = io(Address::HwIoLcdControl);
   if (control & ControlFlags::kBackgroundTileMapDisplaySelect) {
     return 0x9C00;
   }
   return 0x9800;
 }
 
-addr_t Gpu::getScrollX() { return mmu_.read(Address::HwIoScrollX); }
+addr_t Gpu::getScrollX() { return io(Address::HwIoScrollX); }
 
-addr_t Gpu::getScrollY() { return mmu_.read(Address::HwIoScrollY); }
+addr_t Gpu::getScrollY() { return io(Address::HwIoScrollY); }
 
 addr_t Gpu::getWindowTileIndex(u8 windowX, u8 windowY) {
   addr_t windowTileIndex = 0;
@@ -304,7 +409,7 @@ void Gpu::renderScanlineBackground(u8 scanline) {
 
     addr_t bgIndex =
         (windowY / kTileHeight) * kTilesPerRow + (windowX / kTileWidth);
-    addr_t tileIndex = mmu_.read(mapAddr + bgIndex);
+    addr_t tileIndex = mmu_.load(mapAddr + bgIndex);
 
     addr_t tileAddr = dataAddr;
     if (dataAddr == 0x9000 && tileIndex >= 128) {
@@ -315,8 +420,8 @@ void Gpu::renderScanlineBackground(u8 scanline) {
     }
     tileAddr += (windowY % kTileHeight) * 2;
 
-    uint8_t lsb = mmu_.read(tileAddr + 0);
-    uint8_t msb = mmu_.read(tileAddr + 1);
+    uint8_t lsb = mmu_.load(tileAddr + 0);
+    uint8_t msb = mmu_.load(tileAddr + 1);
 
     int palleteIndex = 0;
     int bitIndex = 7 - (windowX % 8);
@@ -324,12 +429,9 @@ void Gpu::renderScanlineBackground(u8 scanline) {
     palleteIndex += ((msb >> bitIndex) & 0x01) ? 1 : 0;
 
     palleteIndex =
-        (mmu_.read(Address::HwIoBackgroundPalette) >> (palleteIndex * 2)) & 0x3;
+        (io(Address::HwIoBackgroundPalette) >> (palleteIndex * 2)) & 0x3;
 
-    int pos = (column + (scanline * kDisplayWidth)) * kColorComponentSize;
-    for (size_t i = 0; i < kColorComponentSize; i++) {
-      pixels_.at(pos + i) = palette_[palleteIndex][i];
-    }
+    plot(column, scanline, palleteIndex);
   }
 }
 
@@ -344,13 +446,13 @@ void Gpu::renderScanlineSprites(u8 scanline) {
   UNUSED(ControlFlags::kSpriteDisplayEnable);
   UNUSED(ControlFlags::kSpriteSizeSelect);
 
-  const u8 control = mmu_.read(Address::HwIoLcdControl);
+  const u8 control = io(Address::HwIoLcdControl);
 
   bool is8x16 = control & ControlFlags::kSpriteSizeSelect;
   const u8 width = 8;
   const u8 height = is8x16 ? 16 : 8;
 
-  auto oam = mmu_.getOAM();
+  auto &oam = mmu_.getOAM();
   Sprite *allSprites = reinterpret_cast<Sprite *>(oam.data());
   auto count = oam.size() / sizeof(Sprite);
 
@@ -394,12 +496,12 @@ void Gpu::renderScanlineSprites(u8 scanline) {
 
     addr_t tileLineAddress = tileAddress + (tileLine * kSpriteTileLineSize);
 
-    u8 lsb = mmu_.read(tileLineAddress);
-    u8 msb = mmu_.read(tileLineAddress + 1);
+    u8 lsb = mmu_.load(tileLineAddress);
+    u8 msb = mmu_.load(tileLineAddress + 1);
 
     u8 spritePallete =
-        mmu_.read(sprite->isPalette1() ? Address::HwIoSpritePalette1
-                                       : Address::HwIoSpritePalette0);
+        io(sprite->isPalette1() ? Address::HwIoSpritePalette1
+                                : Address::HwIoSpritePalette0);
 
     for (size_t i = 0; i < width; i++) {
       if ((sprite->x + i) < width || (sprite->screenX() + i) >= kDisplayWidth) {
@@ -417,10 +519,17 @@ void Gpu::renderScanlineSprites(u8 scanline) {
 
       int column = sprite->screenX() + i;
 
-      int pos = (column + (scanline * kDisplayWidth)) * kColorComponentSize;
-      for (size_t i = 0; i < kColorComponentSize; i++) {
-        pixels_.at(pos + i) = palette_[palleteIndex][i];
-      }
+      plot(column, scanline, palleteIndex);
     }
   }
 }
+
+void Gpu::plot(size_t column, u8 scanline, u8 shade) {
+  size_t pos = column + scanline * kDisplayWidth;
+  if (shades_) {
+    shades_[pos] = shade;
+    return;
+  }
+  std::memcpy(&pixels_.at(pos * kColorComponentSize), palette_[shade],
+              kColorComponentSize);
+}
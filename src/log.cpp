@@ -0,0 +1,196 @@
+/*
+ * log.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <thread>
+
+using namespace gbg;
+
+std::atomic<u32> Log::mask_(0xffffffff);
+
+static const size_t kRingSize = 1024;
+
+static_assert((kRingSize & (kRingSize - 1)) == 0);
+
+static const char *const kLevelNames[] = {"error", "warn", "info", "debug",
+                                          "trace"};
+
+static const char *const kCategoryNames[] = {
+    "app", "cpu", "memory", "dma", "timer", "video", "joypad"};
+
+/**
+ * Bounded multiple producer single consumer ring, each slot carries the
+ * sequence number of the write it expects or holds
+ */
+struct Ring {
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Log::Record record;
+  };
+
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) size_t head;
+  alignas(64) std::atomic<u64> dropped;
+  Slot slots[kRingSize];
+
+  Ring() : tail(0), head(0), dropped(0), slots() {
+    for (size_t i = 0; i < kRingSize; i++) {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+};
+
+static Ring ring;
+
+static std::thread drainer;
+static std::atomic<bool> draining(false);
+static std::FILE *output = nullptr;
+static u64 reported = 0;
+
+static void format(const Log::Record &record, std::string &line) {
+  char buffer[32];
+
+  std::snprintf(buffer, sizeof(buffer), "[%12" PRIu64 "] ", record.cycle);
+  line = buffer;
+  line += kLevelNames[std::min<u8>(record.level, kLogTrace)];
+  line += ' ';
+  size_t category = __builtin_ctz(record.category | 0x80000000u);
+  line += category < sizeof(kCategoryNames) / sizeof(kCategoryNames[0])
+              ? kCategoryNames[category]
+              : "?";
+  line += ": ";
+
+  size_t arg = 0;
+  for (const char *c = record.format; *c; c++) {
+    bool hex = (c[0] == '{' && c[1] == 'x' && c[2] == '}');
+    if (!(c[0] == '{' && c[1] == '}') && !hex) {
+      line += *c;
+      continue;
+    }
+    c += hex ? 2 : 1;
+
+    if (arg >= record.count) {
+      line += "{?}";
+      continue;
+    }
+    auto &value = record.args[arg];
+    switch (record.types[arg]) {
+    case Log::Record::kSigned:
+      std::snprintf(buffer, sizeof(buffer), hex ? "%" PRIx64 : "%" PRId64,
+                    value.i);
+      break;
+    case Log::Record::kUnsigned:
+      std::snprintf(buffer, sizeof(buffer), hex ? "%" PRIx64 : "%" PRIu64,
+                    value.u);
+      break;
+    case Log::Record::kReal:
+      std::snprintf(buffer, sizeof(buffer), "%g", value.d);
+      break;
+    case Log::Record::kText:
+      buffer[0] = '\0';
+      line += record.text;
+      break;
+    }
+    line += buffer;
+    arg++;
+  }
+}
+
+static void drain() {
+  std::string line;
+  while (Log::pop(line)) {
+    std::fprintf(output, "%s\n", line.c_str());
+  }
+
+  u64 dropped = Log::dropped();
+  if (dropped != reported) {
+    std::fprintf(output, "log: %" PRIu64 " messages dropped\n",
+                 dropped - reported);
+    reported = dropped;
+  }
+  std::fflush(output);
+}
+
+void Log::setMask(u32 categories) {
+  mask_.store(categories, std::memory_order_relaxed);
+}
+
+void Log::push(const Record &record) {
+  size_t tail = ring.tail.load(std::memory_order_relaxed);
+  Ring::Slot *slot;
+  for (;;) {
+    slot = &ring.slots[tail & (kRingSize - 1)];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == tail) {
+      if (ring.tail.compare_exchange_weak(tail, tail + 1,
+                                          std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < tail) {
+      // full, the slot still holds a message kRingSize writes old
+      ring.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      tail = ring.tail.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->record = record;
+  slot->sequence.store(tail + 1, std::memory_order_release);
+}
+
+bool Log::pop(std::string &line) {
+  Ring::Slot &slot = ring.slots[ring.head & (kRingSize - 1)];
+  if (slot.sequence.load(std::memory_order_acquire) != ring.head + 1) {
+    return false;
+  }
+
+  format(slot.record, line);
+  slot.sequence.store(ring.head + kRingSize, std::memory_order_release);
+  ring.head++;
+  return true;
+}
+
+u64 Log::dropped() { return ring.dropped.load(std::memory_order_relaxed); }
+
+void Log::start(const std::string &path) {
+  stop();
+
+  output = path.empty() ? stderr : std::fopen(path.c_str(), "w");
+  if (output == nullptr) {
+    output = stderr;
+    GBG_LOG(kLogError, kLogApp, 0, "log: could not open {}", path);
+  }
+
+  draining = true;
+  drainer = std::thread([] {
+    while (draining) {
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+}
+
+void Log::stop() {
+  if (!drainer.joinable()) {
+    return;
+  }
+
+  draining = false;
+  drainer.join();
+  drain();
+
+  if (output != stderr) {
+    std::fclose(output);
+  }
+  output = nullptr;
+}
@@ -8,15 +8,17 @@
 #include "main.hpp"
 #include "address.hpp"
 #include "alu.hpp"
-#include "emulator.hpp"
+#include "emulatorthread.hpp"
+#include "log.hpp"
+#include "movie.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <inttypes.h>
-#include <iomanip>
-#include <iostream>
 #include <sstream>
 #include <thread>
-#include <time.h>
+#include <utility>
 #include <unistd.h>
 
 using namespace std::chrono;
@@ -39,32 +41,98 @@ using namespace std::chrono;
 
 void setCurrentWorkingDirectory(const char *appName);
 nlohmann::json loadDisasmData();
+int playMovie(const std::string &path, u32 seek,
+              const std::string &cartridgePath, Model model);
 
 int main(int argc, char **argv) {
-  UNUSED(argc);
   setCurrentWorkingDirectory(argv[0]);
 
+  std::string cartridgePath = "cartridge.gb";
+  Model model = Model::DMG;
+  bool fastBoot = false;
+  int runAheadFrames = 0;
+  std::string moviePath;
+  u32 movieSeek = 0;
+  std::string recordPath;
+  std::string logPath;
+  float saveInterval = 1.0f;
+  RtcClock rtc = kRtcEmulated;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--cartridge" && (i + 1) < argc) {
+      cartridgePath = argv[++i];
+    } else if (arg == "--fast-boot") {
+      fastBoot = true;
+    } else if (arg == "--sgb") {
+      model = Model::SGB;
+    } else if (arg == "--run-ahead" && (i + 1) < argc) {
+      runAheadFrames = std::atoi(argv[++i]);
+    } else if (arg == "--play" && (i + 1) < argc) {
+      moviePath = argv[++i];
+    } else if (arg == "--seek" && (i + 1) < argc) {
+      movieSeek = std::atoi(argv[++i]);
+    } else if (arg == "--record" && (i + 1) < argc) {
+      recordPath = argv[++i];
+    } else if (arg == "--log" && (i + 1) < argc) {
+      logPath = argv[++i];
+    } else if (arg == "--save-interval" && (i + 1) < argc) {
+      saveInterval = std::atof(argv[++i]);
+    } else if (arg == "--host-rtc") {
+      rtc = kRtcHost;
+    }
+  }
+
+  Log::start(logPath);
+
+  if (!moviePath.empty()) {
+    int status = playMovie(moviePath, movieSeek, cartridgePath, model);
+    Log::stop();
+    return status;
+  }
+
   auto disasm = loadDisasmData();
 
   u8 frameRate = 60;
 
-  s32 lastFrameCount = 0;
-  s32 frameCounter = 0;
-  s64 currentSecond = 0;
-
-  bool running = true;
+  char breakpointInput[5] = "";
+  char watchpointInput[5] = "";
+  bool watchRead = false;
+  bool watchWrite = true;
+
+  // Fast-forward runs speed frames per host frame, rendering only the last
+  // one; at speed 0 it runs unthrottled presenting every frameSkip frames.
+  bool fastForward = false;
+  bool turbo = false;
+  bool rewinding = false;
+  float speed = 4.0f;
+  int frameSkip = 8;
+  int pacing = kPacingHybrid;
+
+  // Return, Space and Z are taken by the debugger
+  const std::pair<sf::Keyboard::Key, Button> keymap[] = {
+      {sf::Keyboard::Right, kButtonRight}, {sf::Keyboard::Left, kButtonLeft},
+      {sf::Keyboard::Up, kButtonUp},       {sf::Keyboard::Down, kButtonDown},
+      {sf::Keyboard::S, kButtonA},         {sf::Keyboard::A, kButtonB},
+      {sf::Keyboard::Q, kButtonSelect},    {sf::Keyboard::W, kButtonStart},
+  };
+  u8 buttons = 0;
 
   sf::RenderWindow window(sf::VideoMode(640, 480), "Goteborg");
-  // window.setFramerateLimit(frameRate);
+  window.setVerticalSyncEnabled(true);
   ImGui::SFML::Init(window);
 
-  Emulator emulator(frameRate);
-  emulator.reset();
+  sf::Texture screen;
+  screen.create(Gpu::kScreenWidth, Gpu::kScreenHeight);
+  sf::Sprite viewport(screen);
 
-  const auto kNanosPerFrame = nanoseconds(1'000'000'000 / frameRate);
+  EmulatorThread emulator(cartridgePath, frameRate, model, fastBoot,
+                          std::max(0, std::min(runAheadFrames, 8)),
+                          saveInterval, rtc, recordPath);
 
-  auto lastTs = high_resolution_clock::now();
-  auto oversleep = nanoseconds(0);
+  auto send = [&emulator](u8 kind, addr_t addr = 0, u8 flags = 0,
+                          float value = 0) {
+    emulator.send({kind, flags, addr, value});
+  };
 
   sf::Clock deltaClock;
   while (window.isOpen()) {
@@ -73,21 +141,17 @@ int main(int argc, char **argv) {
       ImGui::SFML::ProcessEvent(event);
       if (event.type == sf::Event::KeyPressed &&
           event.key.code == sf::Keyboard::Return) {
-        emulator.nextTicks();
+        send(kInputStep);
       }
 
       if (event.type == sf::Event::KeyPressed &&
           event.key.code == sf::Keyboard::Space) {
-        running = !running;
+        send(kInputToggleRun);
       }
 
       if (event.type == sf::Event::KeyPressed &&
           event.key.code == sf::Keyboard::Z) {
-        if (emulator.getRegisters().f & alu::kFZ) {
-          emulator.getRegisters().f &= ~alu::kFZ;
-        } else {
-          emulator.getRegisters().f |= alu::kFZ;
-        }
+        send(kInputToggleZero);
       }
 
       if (event.type == sf::Event::Closed) {
@@ -95,21 +159,44 @@ int main(int argc, char **argv) {
       }
     }
 
-    ImGui::SFML::Update(window, deltaClock.restart());
-
-    if (running) {
-      emulator.nextFrame();
-      if (emulator.getRegisters().pc == 0x027e) {
-        running = false;
+    u8 pressed = 0;
+    for (auto &key : keymap) {
+      if (window.hasFocus() && sf::Keyboard::isKeyPressed(key.first)) {
+        pressed |= key.second;
       }
     }
+    if (pressed != buttons) {
+      buttons = pressed;
+      send(kInputButtons, 0, buttons);
+    }
+
+    bool held = window.hasFocus() &&
+                sf::Keyboard::isKeyPressed(sf::Keyboard::BackSpace);
+    if (held != rewinding) {
+      rewinding = held;
+      send(kInputRewind, 0, rewinding);
+    }
+
+    held = fastForward ||
+           (window.hasFocus() && sf::Keyboard::isKeyPressed(sf::Keyboard::Tab));
+    if (held != turbo) {
+      turbo = held;
+      send(kInputFastForward, 0, turbo);
+    }
+
+    if (emulator.update()) {
+      screen.update(emulator.snapshot().screen.data());
+    }
+    const Snapshot &snapshot = emulator.snapshot();
+
+    ImGui::SFML::Update(window, deltaClock.restart());
 
     ImGui::Begin("Debugger");
 
     ImGui::Text("PC   FLAGS    A  F  B  C  D  E  H  L  AF   BC   DE   HL   SP");
     //           0000 ZNHC---- 00 00 00 00 00 00 00 00 0000 0000 0000 0000 0000
 
-    auto &r = emulator.getRegisters();
+    auto &r = snapshot.regs;
     ImGui::Text(
         "%04x %c%c%c%c%c%c%c%c %02X %02X %02X %02X %02X %02X %02X %02X %04x "
         "%04x %04x %04x %04x",
@@ -119,9 +206,15 @@ int main(int argc, char **argv) {
         (r.f & 0b0000'0010) ? '1' : '-', (r.f & 0b0000'0001) ? '1' : '-', r.a,
         r.f, r.b, r.c, r.d, r.e, r.h, r.l, r.af, r.bc, r.de, r.hl, r.sp);
 
+    // code holds the memory from pc on
+    auto load = [&snapshot](addr_t addr) -> u8 {
+      addr_t offset = addr - snapshot.regs.pc;
+      return offset < snapshot.code.size() ? snapshot.code[offset] : 0xff;
+    };
+
     addr_t addr = r.pc;
     for (int i = 0; i < 16; i++) {
-      size_t opcode = emulator.getMMU().read(addr);
+      size_t opcode = load(addr);
 
       if (opcode == 0xcb) {
         auto op = disasm.at(opcode);
@@ -131,7 +224,7 @@ int main(int argc, char **argv) {
 
         i += 1;
         addr += 1;
-        opcode = 0x100 + emulator.getMMU().read(addr);
+        opcode = 0x100 + load(addr);
 
         if (i >= 16) {
           break;
@@ -145,10 +238,9 @@ int main(int argc, char **argv) {
       if (len == 1) {
         ImGui::Text(text.c_str(), addr);
       } else if (len == 2) {
-        ImGui::Text(text.c_str(), addr, emulator.getMMU().read(addr + 1));
+        ImGui::Text(text.c_str(), addr, load(addr + 1));
       } else if (len == 3) {
-        ImGui::Text(text.c_str(), addr, emulator.getMMU().read(addr + 2),
-                    emulator.getMMU().read(addr + 1));
+        ImGui::Text(text.c_str(), addr, load(addr + 2), load(addr + 1));
       } else {
         ImGui::Text(text.c_str(), addr);
       }
@@ -156,43 +248,131 @@ int main(int argc, char **argv) {
       addr += op.at("length").get<int>();
     }
 
-    s64 epoch = static_cast<s64>(time(nullptr));
-    if (epoch == currentSecond) {
-      frameCounter += 1;
-    } else {
-      currentSecond = epoch;
-      lastFrameCount = frameCounter;
-      frameCounter = 0;
+    ImGui::Text("ui fps: %.1f", snapshot.refreshRate);
+    ImGui::Text("emulated fps: %.1f (%.2fx)", snapshot.emulatedFps,
+                snapshot.emulatedFps / frameRate);
+
+    bool paced = ImGui::RadioButton("hybrid", &pacing, kPacingHybrid);
+    ImGui::SameLine();
+    paced = ImGui::RadioButton("vsync", &pacing, kPacingVsync) || paced;
+    if (paced) {
+      send(kInputPacing, 0, pacing);
     }
 
-    ImGui::Text("fps: %d", lastFrameCount);
+    const auto &frameTimes = snapshot.frameTimes;
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "p50 %.2f p95 %.2f p99 %.2f ms",
+             frameTimes.p50, frameTimes.p95, frameTimes.p99);
+    ImGui::PlotHistogram("frame time", frameTimes.histogram.data(),
+                         frameTimes.histogram.size(), 0, overlay, 0.0f,
+                         Pacer::kSamples, ImVec2(0, 60));
+    ImGui::Text("slack: %.2f ms", frameTimes.slack);
+
+    ImGui::Checkbox("fast-forward (hold tab)", &fastForward);
+    if (ImGui::SliderFloat("speed", &speed, 0.0f, 16.0f,
+                           speed > 0 ? "%.1fx" : "unthrottled")) {
+      send(kInputSpeed, 0, 0, speed);
+    }
+    if (ImGui::SliderInt("frame skip", &frameSkip, 1, 60)) {
+      send(kInputFrameSkip, 0, 0, frameSkip);
+    }
 
-    ImGui::End();
+    if (ImGui::Button("Save state")) {
+      send(kInputSaveState);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Load state")) {
+      send(kInputLoadState);
+    }
+    if (!snapshot.error.empty()) {
+      ImGui::Text("%s", snapshot.error.c_str());
+    }
 
-    window.clear();
-    emulator.render(window);
-    ImGui::SFML::Render(window);
-    window.display();
+    if (snapshot.runAheadFrames > 0) {
+      const auto &timing = snapshot.runAhead;
+      ImGui::Text("run-ahead %d: emulate %" PRId64 " us, save %" PRId64
+                  " us, ahead %" PRId64 " us, restore %" PRId64 " us",
+                  snapshot.runAheadFrames,
+                  static_cast<s64>(timing.emulate.count() / 1000),
+                  static_cast<s64>(timing.save.count() / 1000),
+                  static_cast<s64>(timing.ahead.count() / 1000),
+                  static_cast<s64>(timing.restore.count() / 1000));
+    }
+
+    ImGui::Text("rewind: %" PRIu64 " frames, %zu KiB, %.1f KiB/min",
+                snapshot.rewindFrames, snapshot.rewindUsed / 1024,
+                snapshot.rewindBytesPerMinute / 1024);
+
+    ImGui::Separator();
+
+    if (snapshot.stopped) {
+      auto &hit = snapshot.watchHit;
+      if (snapshot.watched) {
+        ImGui::Text("stopped: %s %04x = %02X",
+                    hit.kind == kWatchRead ? "read" : "write", hit.addr,
+                    hit.value);
+      } else {
+        ImGui::Text("stopped: breakpoint %04x", r.pc);
+      }
+    }
 
-    auto now = high_resolution_clock::now();
-    auto duty = duration_cast<nanoseconds>(now - lastTs);
+    ImGui::InputText("##breakpoint", breakpointInput, sizeof(breakpointInput),
+                     ImGuiInputTextFlags_CharsHexadecimal);
+    ImGui::SameLine();
+    if (ImGui::Button("Add breakpoint") && breakpointInput[0]) {
+      send(kInputAddBreakpoint, strtoul(breakpointInput, nullptr, 16));
+      breakpointInput[0] = '\0';
+    }
 
-    if ((duty + oversleep) < kNanosPerFrame) {
-      auto delay = kNanosPerFrame - duty - oversleep;
-      std::this_thread::sleep_for(nanoseconds(delay));
+    for (auto bp : snapshot.breakpoints) {
+      ImGui::PushID(bp);
+      ImGui::Text("break %04x", bp);
+      ImGui::SameLine();
+      if (ImGui::Button("x")) {
+        send(kInputRemoveBreakpoint, bp);
+      }
+      ImGui::PopID();
+    }
 
-      // store oversleep to compesate for it on frame sync
-      oversleep =
-          duration_cast<nanoseconds>(high_resolution_clock::now() - now) -
-          delay;
-    } else {
-      oversleep = nanoseconds(0);
+    ImGui::InputText("##watchpoint", watchpointInput, sizeof(watchpointInput),
+                     ImGuiInputTextFlags_CharsHexadecimal);
+    ImGui::SameLine();
+    ImGui::Checkbox("r", &watchRead);
+    ImGui::SameLine();
+    ImGui::Checkbox("w", &watchWrite);
+    ImGui::SameLine();
+    if (ImGui::Button("Add watchpoint") && watchpointInput[0] &&
+        (watchRead || watchWrite)) {
+      send(kInputAddWatchpoint, strtoul(watchpointInput, nullptr, 16),
+           (watchRead ? kWatchRead : 0) | (watchWrite ? kWatchWrite : 0));
+      watchpointInput[0] = '\0';
     }
 
-    lastTs = high_resolution_clock::now();
+    for (auto &wp : snapshot.watchpoints) {
+      ImGui::PushID(0x10000 + wp.addr);
+      ImGui::Text("watch %04x %c%c = %02X", wp.addr,
+                  (wp.kind & kWatchRead) ? 'r' : '-',
+                  (wp.kind & kWatchWrite) ? 'w' : '-', wp.value);
+      ImGui::SameLine();
+      if (ImGui::Button("x")) {
+        send(kInputRemoveWatchpoint, wp.addr);
+      }
+      ImGui::PopID();
+    }
+
+    ImGui::End();
+
+    window.clear();
+    window.draw(viewport);
+    ImGui::SFML::Render(window);
+    window.display();
+    emulator.vsync();
   }
 
   ImGui::SFML::Shutdown();
+  // errors writing the movie are logged
+  emulator.stop();
+  Log::stop();
   return 0;
 }
 
@@ -207,4 +387,37 @@ void setCurrentWorkingDirectory(const char *appName) {
 nlohmann::json loadDisasmData() {
   std::ifstream ifs("disasm.json");
   return nlohmann::json::parse(ifs);
-}
\ No newline at end of file
+}
+
+int playMovie(const std::string &path, u32 seek,
+              const std::string &cartridgePath, Model model) {
+  // Headless, unthrottled and without rendering
+  Emulator emulator(60);
+  Movie movie;
+  emulator.setCartridgePath(cartridgePath);
+  // keep the save file of the player as it is
+  emulator.setSavePath("");
+  try {
+    emulator.reset(model);
+    movie.load(path);
+    // seek past the end stops at it
+    movie.seek(emulator, seek);
+    seek = movie.frame();
+  } catch (std::exception &e) {
+    GBG_LOG(kLogError, kLogApp, emulator.cycles(), "{}", e.what());
+    return EXIT_FAILURE;
+  }
+
+  emulator.setRendering(false);
+  auto start = steady_clock::now();
+  while (movie.playFrame(emulator)) {
+  }
+  auto elapsed = duration<double>(steady_clock::now() - start).count();
+
+  auto &regs = emulator.getRegisters();
+  u32 frames = movie.frames() - seek;
+  GBG_LOG(kLogInfo, kLogApp, emulator.cycles(),
+          "played {} frames in {} s ({} fps) pc={x}", frames, elapsed,
+          frames / elapsed, regs.pc);
+  return EXIT_SUCCESS;
+}
@@ -6,41 +6,22 @@
  */
 
 #include "mmuimpl.hpp"
+#include "address.hpp"
 #include "interrupt.hpp"
+#include "log.hpp"
 
 #include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cmath>
-#include <iomanip>
-#include <iostream>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 #include <utility>
 
 using namespace gbg;
-
-namespace MemAddr {
-static const addr_t kBiosROM = 0x0000;
-static const addr_t kCartridgeROM = 0x0000;
-static const addr_t kVideoRAM = 0x8000;
-static const addr_t kCartridgeRAM = 0xA000;
-static const addr_t kLowRAM = 0xC000;
-static const addr_t kEchoRAM = 0xE000;
-static const addr_t kOamRAM = 0xFE00;
-static const addr_t kInvRAM = 0xFEA0;
-static const addr_t kHwIO = 0xFF00;
-static const addr_t kHighRAM = 0xFF80;
-} // namespace MemAddr
-
-namespace MemSize {
-static const size_t kBiosROM = 0x0100;
-static const size_t kCartridgeROM = 0x8000;
-static const size_t kVideoRAM = 0x2000;
-static const size_t kCartridgeRAM = 0x2000;
-static const size_t kLowRAM = 0x2000;
-static const size_t kEchoRAM = 0x1E00;
-static const size_t kOamRAM = 0x00A0;
-static const size_t kInvRAM = 0x0060;
-static const size_t kHwIO = 0x0080;
-static const size_t kHighRAM = 0x0080;
-} // namespace MemSize
+using namespace std::chrono;
 
 static_assert(MemAddr::kBiosROM == 0,
               "bios should be at start of address space");
@@ -62,75 +43,800 @@ static_assert((MemAddr::kInvRAM + MemSize::kInvRAM) == MemAddr::kHwIO);
 static_assert((MemAddr::kHwIO + MemSize::kHwIO) == MemAddr::kHighRAM);
 static_assert((MemAddr::kHighRAM + MemSize::kHighRAM) == 0x10000);
 
+static const u8 kHwIoIndexJoypad = 0x00;
+static const u8 kHwIoIndexTimerDivider = 0x04;
+static const u8 kHwIoIndexTimerCounter = 0x05;
+static const u8 kHwIoIndexTimerModulo = 0x06;
+static const u8 kHwIoIndexTimerControl = 0x07;
+static const u8 kHwIoIndexInterruptFlag = 0x0f;
+static const u8 kHwIoIndexDma = 0x46;
+static const u8 kHwIoIndexBootLatch = 0x50;
+
+static const addr_t kCartridgeType = 0x0147;
+static const addr_t kCartridgeRamSize = 0x0149;
+
+// Mbc3 clock registers are selected as ram banks, seconds then minutes,
+// hours, low and high day
+static const u8 kRtcSeconds = 0x08;
+
+static const u8 kRtcDayHighBit = 0x01;
+static const u8 kRtcHaltFlag = 0x40;
+static const u8 kRtcCarryFlag = 0x80;
+
+static const ticks_t kRtcDays = 0x200;
+static const ticks_t kSecondsPerDay = 24 * 60 * 60;
+
+// Clock footer of battery backed ram as other emulators write it: current
+// and latched registers as 32-bit words, then the unix time of the save
+static const size_t kRtcFooterSize = 10 * sizeof(u32) + sizeof(u64);
+
+// Index into the ram pages of a video, low or echo ram address
+static size_t ramPage(addr_t addr) {
+  if (addr >= MemAddr::kEchoRAM) {
+    addr -= MemAddr::kEchoRAM - MemAddr::kLowRAM;
+  }
+  if (addr >= MemAddr::kLowRAM) {
+    addr -= MemSize::kCartridgeRAM;
+  }
+  return (addr - MemAddr::kVideoRAM) >> 8;
+}
+
 MMUImpl::MMUImpl()
-    : MMU(), bios_(MemSize::kBiosROM, 0xff),
-      crom_(MemSize::kCartridgeROM, 0xff), vram_(MemSize::kVideoRAM, 0xff),
-      cram_(MemSize::kCartridgeRAM, 0xff), lram_(MemSize::kLowRAM, 0xff),
-      oram_(MemSize::kOamRAM, 0xff), hwio_(MemSize::kHwIO, 0),
-      hram_(MemSize::kHighRAM, 0xff), timer_(0), divider_(0) {}
+    : MMU(), bios_(std::make_shared<buffer_t>(MemSize::kBiosROM, 0xff)),
+      crom_(std::make_shared<buffer_t>(MemSize::kCartridgeROM, 0xff)),
+      saveRam_(), cramBlocks_(), cramPages_(), cramWritable_(),
+      mbc_(kMbcNone), romBank_(1), ramBank_(0),
+      ramEnabled_(false), bankMode_(0), ramSize_(0), rtcClock_(kRtcEmulated),
+      rtc_(false), rtcBase_(0), rtcEpoch_(0), rtcHalt_(false),
+      rtcCarry_(false), rtcLatch_(0xff), rtcLatched_(), arena_(new Arena()),
+      ram_(), blocks_(), pages_(), writable_(),
+      oram_(arena_->oram), hwio_(arena_->hwio), hram_(arena_->hram), reads_(),
+      writes_(), dirty_(), dirtyGeneration_(1), clock_(0), divBase_(0),
+      timaBase_(0), timerEvent_(0), tima_(0), dmaEnd_(0), buttons_(0),
+      watchPages_(), watchpoints_(), watchHit_() {
+  static_assert(MemSize::kHwIO == kIoInterruptSwitch);
+
+  for (size_t i = 0; i < kIoRegisters; i++) {
+    setIoHandler(i, ioHandler<MMUImpl, &MMUImpl::readIo, &MMUImpl::writeIo>(
+                        this));
+  }
+
+  // joypad
+  setIoHandler(kHwIoIndexJoypad,
+               ioHandler<MMUImpl, &MMUImpl::readJoypad, &MMUImpl::writeJoypad>(
+                   this));
+
+  // timer
+  setIoHandler(
+      kHwIoIndexTimerDivider,
+      ioHandler<MMUImpl, &MMUImpl::readDivider, &MMUImpl::writeDivider>(this));
+  setIoHandler(kHwIoIndexTimerCounter,
+               ioHandler<MMUImpl, &MMUImpl::readTimerCounter,
+                         &MMUImpl::writeTimerCounter>(this));
+  setIoHandler(
+      kHwIoIndexTimerControl,
+      ioHandler<MMUImpl, &MMUImpl::readIo, &MMUImpl::writeTimerControl>(
+          this));
+
+  // dma
+  setIoHandler(kHwIoIndexDma,
+               ioHandler<MMUImpl, &MMUImpl::readIo, &MMUImpl::writeDma>(this));
+
+  // boot rom
+  setIoHandler(
+      kHwIoIndexBootLatch,
+      ioHandler<MMUImpl, &MMUImpl::readIo, &MMUImpl::writeBootLatch>(this));
+
+  reset();
+}
+
+MMUImpl::~MMUImpl() { flushSaveRam(true); }
 
 void MMUImpl::loadBios(const buffer_t &bios) {
   if (bios.size() != 256) {
     throw std::runtime_error("bios must be 256 bytes long");
   }
 
-  bios_ = bios;
+  bios_ = std::make_shared<buffer_t>(bios);
+  map(MemAddr::kBiosROM >> 8);
+  generation_++;
 }
 
-void MMUImpl::loadCartridge(const buffer_t &rom) {
+// Ram size header codes, 2 is a single bank and 1 a partial one
+static const size_t kCartridgeRamSizes[] = {0, 0x800, 0x2000, 0x8000,
+                                            0x20000, 0x10000};
+
+void MMUImpl::loadCartridge(const buffer_t &rom, const std::string &savePath) {
   auto result = div(rom.size(), 32 * 1024);
   if (rom.size() == 0 && result.rem != 0) {
     throw std::runtime_error("cartridge rom must be multiple of 32Kb");
   }
-  crom_ = rom;
+  // the clock of the previous cartridge goes to its footer
+  flushSaveRam(true);
+  crom_ = std::make_shared<buffer_t>(rom);
+
+  u8 type = rom.size() > kCartridgeType ? rom[kCartridgeType] : 0;
+  u8 code = rom.size() > kCartridgeRamSize ? rom[kCartridgeRamSize] : 0;
+
+  bool battery = false;
+  rtc_ = (type == 0x0f || type == 0x10);
+  switch (type) {
+  case 0x01: // mbc1
+  case 0x02: // mbc1+ram
+    mbc_ = kMbc1;
+    break;
+  case 0x03: // mbc1+ram+battery
+    mbc_ = kMbc1;
+    battery = true;
+    break;
+  case 0x11: // mbc3
+  case 0x12: // mbc3+ram
+    mbc_ = kMbc3;
+    break;
+  case 0x0f: // mbc3+timer+battery
+  case 0x10: // mbc3+timer+ram+battery
+  case 0x13: // mbc3+ram+battery
+    mbc_ = kMbc3;
+    battery = true;
+    break;
+  case 0x19: // mbc5
+  case 0x1a: // mbc5+ram
+  case 0x1c: // mbc5+rumble
+  case 0x1d: // mbc5+rumble+ram
+    mbc_ = kMbc5;
+    break;
+  case 0x1b: // mbc5+ram+battery
+  case 0x1e: // mbc5+rumble+ram+battery
+    mbc_ = kMbc5;
+    battery = true;
+    break;
+  case 0x09: // rom+ram+battery
+    mbc_ = kMbcNone;
+    battery = true;
+    break;
+  default:
+    mbc_ = kMbcNone;
+    break;
+  }
+
+  size_t size = code < sizeof(kCartridgeRamSizes) / sizeof(size_t)
+                    ? kCartridgeRamSizes[code]
+                    : 0;
+  ramSize_ = size;
+  saveRam_ = std::make_shared<SaveRam>();
+  saveRam_->map(battery ? savePath : "", size + (rtc_ ? kRtcFooterSize : 0));
+  cramBlocks_.resize(size / kPageSize);
+  cramPages_.resize(size / kPageSize);
+  cramWritable_.resize(size / kPageSize);
+  ownAllCram();
+  GBG_LOG(kLogInfo, kLogMemory, clock_, "cartridge type {x} ram {} bytes{}",
+          type, size, saveRam_->persistent() ? " saved" : "");
+  if (rtc_) {
+    loadRtc();
+  }
+
+  romBank_ = 1;
+  ramBank_ = 0;
+  ramEnabled_ = false;
+  bankMode_ = 0;
+  mapAll();
+  generation_++;
 }
 
-u8 MMUImpl::read(addr_t src) {
-  if (src < (MemAddr::kBiosROM + MemSize::kBiosROM) && hwio_.at(0x50) != 1) {
+void MMUImpl::flushSaveRam(bool wait) {
+  if (!saveRam_ || !saveRam_->persistent()) {
+    return;
+  }
+  if (rtc_) {
+    storeRtc();
+  }
+  saveRam_->flush(wait);
+}
+
+size_t MMUImpl::cartridgeRamSize() const { return ramSize_; }
+
+u8 *MMUImpl::own(u8 page) {
+  if (!ram_) {
+    // first write since the fork, left uninitialized as pages are copied in
+    ram_.reset(new RamBlock);
+  }
+
+  size_t index = ramPage(page << 8);
+  u8 *data = ram_->page(index);
+  if (pages_[index] != data) {
+    std::memcpy(data, pages_[index], kPageSize);
+    blocks_[index] = ram_;
+    pages_[index] = data;
+    // fetch windows may still point at the shared copy
+    generation_++;
+  }
+  writable_[index] = data;
+
+  remap(page);
+  return data;
+}
+
+MMUImpl::RamBlock &MMUImpl::ownAll() {
+  if (!ram_) {
+    ram_.reset(new RamBlock);
+  }
+  for (size_t i = 0; i < kPages; i++) {
+    if (blocks_[i] != ram_) {
+      blocks_[i] = ram_;
+    }
+    pages_[i] = writable_[i] = ram_->page(i);
+  }
+  return *ram_;
+}
+
+u8 *MMUImpl::ownCram(size_t index) {
+  if (!saveRam_) {
+    // first write since the fork, pages are copied in
+    saveRam_ = std::make_shared<SaveRam>();
+    saveRam_->map("", ramSize_);
+  }
+
+  u8 *data = saveRam_->data() + index * kPageSize;
+  if (cramPages_[index] != data) {
+    std::memcpy(data, cramPages_[index], kPageSize);
+    cramBlocks_[index] = saveRam_;
+    cramPages_[index] = data;
+    generation_++;
+  }
+  cramWritable_[index] = data;
+  return data;
+}
+
+SaveRam &MMUImpl::ownAllCram() {
+  if (!saveRam_) {
+    saveRam_ = std::make_shared<SaveRam>();
+    saveRam_->map("", ramSize_);
+  }
+  for (size_t i = 0; i < cramPages_.size(); i++) {
+    cramBlocks_[i] = saveRam_;
+    cramPages_[i] = cramWritable_[i] = saveRam_->data() + i * kPageSize;
+  }
+  return *saveRam_;
+}
+
+void MMUImpl::remap(u8 page) {
+  map(page);
+  if (page >= (MemAddr::kLowRAM >> 8) &&
+      page < ((MemAddr::kLowRAM + MemSize::kEchoRAM) >> 8)) {
+    map(page + ((MemAddr::kEchoRAM - MemAddr::kLowRAM) >> 8));
+  }
+}
+
+void MMUImpl::touch(u8 page) {
+  if (dirty_[page] != dirtyGeneration_) {
+    dirty_[page] = dirtyGeneration_;
+    remap(page);
+  }
+}
+
+void MMUImpl::map(u8 page) {
+  const u8 *read = nullptr;
+  u8 *write = nullptr;
+
+  addr_t addr = page << 8;
+  if (watchPages_[page]) {
+    // slow path checks watchpoints
+  } else if (addr == MemAddr::kBiosROM &&
+             hwio_[kHwIoIndexBootLatch] != 1) {
+    // boot rom overlay until the latch is written
+    if (bios_->size() >= kPageSize) {
+      read = bios_->data();
+    }
+  } else if (addr < MemAddr::kCartridgeROM + MemSize::kCartridgeROM) {
+    size_t offset = romOffset(addr);
+    if (offset + kPageSize <= crom_->size()) {
+      read = crom_->data() + offset;
+    }
+  } else if (addr >= MemAddr::kCartridgeRAM &&
+             addr < MemAddr::kCartridgeRAM + MemSize::kCartridgeRAM) {
+    // disabled or missing ram reads 0xff through the slow path
+    size_t offset = ramOffset(addr);
+    if (ramEnabled_ && !rtcSelected() && offset + kPageSize <= ramSize_) {
+      read = cramPages_[offset / kPageSize];
+      if (dirty_[page] == dirtyGeneration_) {
+        write = cramWritable_[offset / kPageSize];
+      }
+    }
+  } else if (addr < MemAddr::kEchoRAM + MemSize::kEchoRAM) {
+    size_t index = ramPage(addr);
+    addr_t canonical = addr >= MemAddr::kEchoRAM
+                           ? addr - (MemAddr::kEchoRAM - MemAddr::kLowRAM)
+                           : addr;
+    read = pages_[index];
+    if (dirty_[canonical >> 8] == dirtyGeneration_) {
+      write = writable_[index];
+    }
+  }
+
+  reads_[page] = read;
+  writes_[page] = write;
+}
+
+void MMUImpl::mapAll() {
+  for (size_t page = 0; page < 0x100; page++) {
+    map(page);
+  }
+}
+
+u8 &MMUImpl::ram(addr_t addr) {
+  if (addr >= MemAddr::kEchoRAM) {
+    addr -= MemAddr::kEchoRAM - MemAddr::kLowRAM;
+  }
+  u8 *page = writable_[ramPage(addr)];
+  if (page == nullptr) {
+    page = own(addr >> 8);
+  }
+  touch(addr >> 8);
+  return page[addr & 0xff];
+}
+
+size_t MMUImpl::romOffset(addr_t addr) const {
+  if (addr < kRomBankSize) {
+    return addr;
+  }
+  size_t banks = std::max<size_t>(
+      (crom_->size() + kRomBankSize - 1) / kRomBankSize, 2);
+  return (romBank_ % banks) * kRomBankSize + (addr - kRomBankSize);
+}
+
+size_t MMUImpl::ramOffset(addr_t addr) const {
+  // mbc1 switches ram banks only in mode 1
+  u8 bank = (mbc_ == kMbc1 && bankMode_ == 0) ? 0 : ramBank_;
+  size_t size = std::max(ramSize_, MemSize::kCartridgeRAM);
+  return (bank * MemSize::kCartridgeRAM) % size +
+         (addr - MemAddr::kCartridgeRAM);
+}
+
+bool MMUImpl::rtcSelected() const {
+  return mbc_ == kMbc3 && rtc_ && ramBank_ >= kRtcSeconds;
+}
+
+// Host wall time in cycles since the unix epoch
+static ticks_t hostCycles() {
+  auto us =
+      duration_cast<microseconds>(system_clock::now().time_since_epoch())
+          .count();
+  return (us / 1000000) * kClockRate + (us % 1000000) * kClockRate / 1000000;
+}
+
+ticks_t MMUImpl::rtcNow() const {
+  return rtcClock_ == kRtcHost ? hostCycles() : clock_;
+}
+
+ticks_t MMUImpl::rtcCycles() const {
+  return rtcHalt_ ? rtcBase_ : rtcBase_ + (rtcNow() - rtcEpoch_);
+}
+
+void MMUImpl::setRtcClock(RtcClock clock) {
+  ticks_t rtc = rtcCycles();
+  rtcClock_ = clock;
+  rtcBase_ = rtc;
+  rtcEpoch_ = rtcNow();
+}
+
+// Break seconds into the clock registers, the day counter carries out
+// of its 9 bits into the carry flag
+static void rtcRegisters(ticks_t seconds, bool halt, bool carry, u8 *regs) {
+  ticks_t days = seconds / kSecondsPerDay;
+  regs[0] = seconds % 60;
+  regs[1] = seconds / 60 % 60;
+  regs[2] = seconds / (60 * 60) % 24;
+  regs[3] = days & 0xff;
+  regs[4] = ((days >> 8) & kRtcDayHighBit) | (halt ? kRtcHaltFlag : 0) |
+            ((carry || days >= kRtcDays) ? kRtcCarryFlag : 0);
+}
+
+static ticks_t rtcSeconds(const u8 *regs) {
+  ticks_t days = regs[3] | ((regs[4] & kRtcDayHighBit) << 8);
+  return regs[0] + regs[1] * 60 + regs[2] * 60 * 60 + days * kSecondsPerDay;
+}
+
+void MMUImpl::latchRtc() {
+  rtcRegisters(rtcCycles() / kClockRate, rtcHalt_, rtcCarry_, rtcLatched_);
+  GBG_LOG(kLogTrace, kLogTimer, clock_, "rtc latched day {} {}:{}:{}",
+          rtcLatched_[3] | ((rtcLatched_[4] & kRtcDayHighBit) << 8),
+          rtcLatched_[2], rtcLatched_[1], rtcLatched_[0]);
+}
+
+void MMUImpl::writeRtc(u8 reg, u8 value) {
+  static const u8 kMasks[] = {0x3f, 0x3f, 0x1f, 0xff,
+                              kRtcDayHighBit | kRtcHaltFlag | kRtcCarryFlag};
+
+  // Rebuild the count from the current registers with reg replaced, as the
+  // latched ones may be stale
+  ticks_t cycles = rtcCycles();
+  u8 regs[sizeof(rtcLatched_)];
+  rtcRegisters(cycles / kClockRate, rtcHalt_, rtcCarry_, regs);
+  regs[reg] = value & kMasks[reg];
+  rtcLatched_[reg] = regs[reg];
+
+  // writing seconds clears the sub-second divider
+  ticks_t fraction = (reg == 0) ? 0 : cycles % kClockRate;
+  rtcBase_ = rtcSeconds(regs) * kClockRate + fraction;
+  rtcEpoch_ = rtcNow();
+  rtcHalt_ = regs[4] & kRtcHaltFlag;
+  rtcCarry_ = regs[4] & kRtcCarryFlag;
+}
+
+template <typename T> static T loadWord(const u8 *src) {
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    value |= static_cast<T>(src[i]) << (i * 8);
+  }
+  return value;
+}
+
+template <typename T> static void storeWord(u8 *dst, T value) {
+  for (size_t i = 0; i < sizeof(T); i++) {
+    dst[i] = value >> (i * 8);
+  }
+}
+
+void MMUImpl::loadRtc() {
+  const u8 *footer = saveRam_->data() + ramSize_;
+  u8 regs[sizeof(rtcLatched_)];
+  for (size_t i = 0; i < sizeof(rtcLatched_); i++) {
+    regs[i] = loadWord<u32>(footer + i * sizeof(u32));
+    rtcLatched_[i] = loadWord<u32>(footer + (5 + i) * sizeof(u32));
+  }
+  ticks_t saved = loadWord<u64>(footer + 10 * sizeof(u32)) * kClockRate;
+
+  rtcBase_ = rtcSeconds(regs) * kClockRate;
+  rtcHalt_ = regs[4] & kRtcHaltFlag;
+  rtcCarry_ = regs[4] & kRtcCarryFlag;
+  rtcLatch_ = 0xff;
+  rtcEpoch_ = rtcNow();
+  if (rtcClock_ == kRtcHost && saved != 0 && saved < rtcEpoch_) {
+    // host time went by while the cartridge was not running
+    rtcEpoch_ = saved;
+  }
+}
+
+void MMUImpl::storeRtc() {
+  u8 *footer = saveRam_->data() + ramSize_;
+  u8 regs[sizeof(rtcLatched_)];
+  rtcRegisters(rtcCycles() / kClockRate, rtcHalt_, rtcCarry_, regs);
+  for (size_t i = 0; i < sizeof(rtcLatched_); i++) {
+    storeWord<u32>(footer + i * sizeof(u32), regs[i]);
+    storeWord<u32>(footer + (5 + i) * sizeof(u32), rtcLatched_[i]);
+  }
+  storeWord<u64>(footer + 10 * sizeof(u32), hostCycles() / kClockRate);
+}
+
+void MMUImpl::writeMbc(addr_t dst, u8 value) {
+  if (mbc_ == kMbcNone) {
+    return;
+  }
+
+  // every controller splits the rom into four register ranges
+  switch (dst >> 13) {
+  case 0:
+    ramEnabled_ = (value & 0x0f) == 0x0a;
+    break;
+  case 1:
+    if (mbc_ == kMbc1) {
+      // bank 0 selects 1, so does 0x20 and the like
+      u8 low = value & 0x1f;
+      romBank_ = (romBank_ & 0x60) | (low ? low : 1);
+    } else if (mbc_ == kMbc3) {
+      u8 bank = value & 0x7f;
+      romBank_ = bank ? bank : 1;
+    } else if (dst < 0x3000) {
+      romBank_ = (romBank_ & 0x100) | value;
+    } else {
+      romBank_ = (romBank_ & 0xff) | ((value & 0x01) << 8);
+    }
+    break;
+  case 2:
+    if (mbc_ == kMbc1) {
+      // upper rom bank bits, or ram bank in mode 1
+      romBank_ = (romBank_ & 0x1f) | ((value & 0x03) << 5);
+      ramBank_ = value & 0x03;
+    } else {
+      // mbc3 selects clock registers from 0x08 on
+      ramBank_ = value & 0x0f;
+    }
+    break;
+  case 3:
+    if (mbc_ == kMbc1) {
+      bankMode_ = value & 0x01;
+    } else if (mbc_ == kMbc3 && rtc_) {
+      if (rtcLatch_ == 0x00 && value == 0x01) {
+        latchRtc();
+      }
+      rtcLatch_ = value;
+      return;
+    }
+    break;
+  }
+
+  for (size_t page = MemAddr::kCartridgeROM >> 8;
+       page < (MemAddr::kCartridgeROM + MemSize::kCartridgeROM) >> 8;
+       page++) {
+    map(page);
+  }
+  for (size_t page = MemAddr::kCartridgeRAM >> 8;
+       page < (MemAddr::kCartridgeRAM + MemSize::kCartridgeRAM) >> 8;
+       page++) {
+    map(page);
+  }
+  // fetch windows may point at the old banks
+  generation_++;
+}
+
+void MMUImpl::fork(MMUImpl &child) {
+  child.bios_ = bios_;
+  child.crom_ = crom_;
+  child.mbc_ = mbc_;
+  child.romBank_ = romBank_;
+  child.ramBank_ = ramBank_;
+  child.ramEnabled_ = ramEnabled_;
+  child.bankMode_ = bankMode_;
+  child.ramSize_ = ramSize_;
+  child.rtcClock_ = rtcClock_;
+  child.rtc_ = rtc_;
+  child.rtcBase_ = rtcBase_;
+  child.rtcEpoch_ = rtcEpoch_;
+  child.rtcHalt_ = rtcHalt_;
+  child.rtcCarry_ = rtcCarry_;
+  child.rtcLatch_ = rtcLatch_;
+  std::copy_n(rtcLatched_, sizeof(rtcLatched_), child.rtcLatched_);
+
+  // Cartridge ram is shared the same way, but for the save file which the
+  // parent keeps writing in place, the child takes a copy of it instead
+  child.cramBlocks_ = cramBlocks_;
+  child.cramPages_ = cramPages_;
+  child.cramWritable_.assign(cramWritable_.size(), nullptr);
+  child.saveRam_.reset();
+  if (saveRam_ && saveRam_->persistent()) {
+    SaveRam &cram = child.ownAllCram();
+    if (ramSize_ > 0) {
+      std::memcpy(cram.data(), saveRam_->data(), ramSize_);
+    }
+  } else {
+    saveRam_.reset();
+    std::fill(cramWritable_.begin(), cramWritable_.end(), nullptr);
+  }
+
+  // Blocks as of now are read by both sides until they write, neither
+  // writes into them again
+  ram_.reset();
+  child.ram_.reset();
+  for (size_t i = 0; i < kPages; i++) {
+    child.blocks_[i] = blocks_[i];
+    child.pages_[i] = pages_[i];
+    writable_[i] = child.writable_[i] = nullptr;
+  }
+  mapAll();
+  generation_++;
+
+  child.oram_ = oram_;
+  child.hwio_ = hwio_;
+  child.hram_ = hram_;
+  child.clock_ = clock_;
+  child.divBase_ = divBase_;
+  child.timaBase_ = timaBase_;
+  child.timerEvent_ = timerEvent_;
+  child.tima_ = tima_;
+  child.dmaEnd_ = dmaEnd_;
+  child.buttons_ = buttons_;
+  std::copy_n(dirty_, 0x100, child.dirty_);
+  child.dirtyGeneration_ = dirtyGeneration_;
+
+  child.mapAll();
+  child.trapped_ = false;
+  child.generation_++;
+}
+
+size_t MMUImpl::sharedPages() const {
+  return std::count(writable_, writable_ + kPages, nullptr);
+}
+
+u32 MMUImpl::dirtyPages(u32 since, PageSet &pages) {
+  for (size_t i = 0; i < pages.size(); i++) {
+    pages[i] = dirty_[i] > since;
+  }
+
+  // Unmap ram for writing, the next write to each page marks it again
+  u32 generation = dirtyGeneration_++;
+  for (size_t i = MemAddr::kVideoRAM >> 8; i < MemAddr::kOamRAM >> 8; i++) {
+    writes_[i] = nullptr;
+  }
+  return generation;
+}
+
+const buffer_t &MMUImpl::cartridge() const { return *crom_; }
+
+void MMUImpl::setButtons(u8 buttons) {
+  u8 lines = readJoypad(kHwIoIndexJoypad);
+  buttons_ = buttons;
+  joypadInterrupt(lines);
+}
+
+u8 MMUImpl::buttons() const { return buttons_; }
+
+void MMUImpl::reset() {
+  RamBlock &ram = ownAll();
+  ram.vram.fill(0xff);
+  ram.lram.fill(0xff);
+  oram_.fill(0xff);
+  hwio_.fill(0);
+  hram_.fill(0xff);
+
+  // the clock runs on through resets
+  ticks_t rtc = rtcCycles();
+  clock_ = 0;
+  rtcBase_ = rtc;
+  rtcEpoch_ = rtcNow();
+  loadTimer(0);
+  dmaEnd_ = 0;
+  buttons_ = 0;
+
+  // cartridge ram is kept, like battery backed ram across power cycles
+  romBank_ = 1;
+  ramBank_ = 0;
+  ramEnabled_ = false;
+  bankMode_ = 0;
+
+  std::fill_n(dirty_, 0x100, dirtyGeneration_);
+  mapAll();
+  trapped_ = false;
+  generation_++;
+}
+
+namespace PostBoot {
+struct IoRegister {
+  u8 index;
+  u8 dmg;
+  u8 sgb;
+};
+
+static const IoRegister kIoRegisters[] = {
+    {0x00, 0xcf, 0xcf}, {0x01, 0x00, 0x00}, {0x02, 0x7e, 0x7e},
+    {0x04, 0xab, 0xab}, {0x05, 0x00, 0x00}, {0x06, 0x00, 0x00},
+    {0x07, 0xf8, 0xf8}, {0x0f, 0xe1, 0xe1}, {0x10, 0x80, 0x80},
+    {0x11, 0xbf, 0xbf}, {0x12, 0xf3, 0xf3}, {0x13, 0xff, 0xff},
+    {0x14, 0xbf, 0xbf}, {0x16, 0x3f, 0x3f}, {0x17, 0x00, 0x00},
+    {0x18, 0xff, 0xff}, {0x19, 0xbf, 0xbf}, {0x1a, 0x7f, 0x7f},
+    {0x1b, 0xff, 0xff}, {0x1c, 0x9f, 0x9f}, {0x1d, 0xff, 0xff},
+    {0x1e, 0xbf, 0xbf}, {0x20, 0xff, 0xff}, {0x21, 0x00, 0x00},
+    {0x22, 0x00, 0x00}, {0x23, 0xbf, 0xbf}, {0x24, 0x77, 0x77},
+    {0x25, 0xf3, 0xf3}, {0x26, 0xf1, 0xf0}, {0x40, 0x91, 0x91},
+    {0x42, 0x00, 0x00}, {0x43, 0x00, 0x00}, {0x45, 0x00, 0x00},
+    {0x46, 0xff, 0xff}, {0x47, 0xfc, 0xfc}, {0x48, 0xff, 0xff},
+    {0x49, 0xff, 0xff}, {0x4a, 0x00, 0x00}, {0x4b, 0x00, 0x00},
+};
+
+static const addr_t kLogoAddr = 0x0104;
+static const size_t kLogoSize = 48;
+
+static const addr_t kLogoTileAddr = 0x8010;
+static const addr_t kLogoMapAddr = 0x9904;
+static const u8 kLogoTilesPerRow = 12;
+
+// (R) symbol, tile 0x19
+static const addr_t kTrademarkTileAddr = 0x8190;
+static const addr_t kTrademarkMapAddr = 0x9910;
+static const u8 kTrademarkTile = 0x19;
+static const u8 kTrademark[8] = {0x3c, 0x42, 0xb9, 0xa5,
+                                 0xb9, 0xa5, 0x42, 0x3c};
+} // namespace PostBoot
+
+void MMUImpl::skipBios(Model model) {
+  for (const auto &r : PostBoot::kIoRegisters) {
+    hwio_[r.index] = (model == Model::SGB) ? r.sgb : r.dmg;
+  }
+  hram_[Address::HwIoInterruptSwitch - MemAddr::kHighRAM] = 0x00;
+
+  hwio_[kHwIoIndexBootLatch] = 1;
+  loadTimer(hwio_[kHwIoIndexTimerDivider] << 8);
+  map(MemAddr::kBiosROM >> 8);
+  generation_++;
+
+  // Boot rom clears video ram then decompresses the cartridge logo into
+  // tiles 1-24, every bit of the logo doubled horizontally and vertically.
+  for (size_t i = 0; i < MemSize::kVideoRAM; i += kPageSize) {
+    std::fill_n(&ram(MemAddr::kVideoRAM + i), kPageSize, 0);
+  }
+
+  addr_t tile = PostBoot::kLogoTileAddr;
+  for (size_t i = 0; i < PostBoot::kLogoSize; i++) {
+    u8 logo = load(PostBoot::kLogoAddr + i);
+
+    for (int shift = 4; shift >= 0; shift -= 4) {
+      u8 doubled = 0;
+      for (int bit = 0; bit < 4; bit++) {
+        if ((logo >> (shift + bit)) & 0x01) {
+          doubled |= 0x03 << (bit * 2);
+        }
+      }
+      ram(tile + 0) = doubled;
+      ram(tile + 2) = doubled;
+      tile += 4;
+    }
+  }
+
+  tile = PostBoot::kTrademarkTileAddr;
+  for (size_t i = 0; i < sizeof(PostBoot::kTrademark); i++) {
+    ram(tile + i * 2) = PostBoot::kTrademark[i];
+  }
+
+  addr_t map = PostBoot::kLogoMapAddr;
+  for (u8 i = 0; i < PostBoot::kLogoTilesPerRow; i++) {
+    ram(map + i) = 1 + i;
+    ram(map + 0x20 + i) = 1 + PostBoot::kLogoTilesPerRow + i;
+  }
+  ram(PostBoot::kTrademarkMapAddr) = PostBoot::kTrademarkTile;
+}
+
+u8 MMUImpl::load(addr_t src) {
+  if (const u8 *page = reads_[src >> 8]) {
+    return page[src & 0xff];
+  }
+  return loadSlow(src);
+}
+
+u8 MMUImpl::loadSlow(addr_t src) {
+  if (src < (MemAddr::kBiosROM + MemSize::kBiosROM) &&
+      hwio_[kHwIoIndexBootLatch] != 1) {
     src -= MemAddr::kBiosROM;
-    return bios_.at(src);
+    return (*bios_)[src];
   }
 
   static_assert(MemSize::kCartridgeRAM < MemAddr::kVideoRAM);
 
   if (src < (MemAddr::kCartridgeROM + MemSize::kCartridgeROM)) {
-    src -= MemAddr::kCartridgeROM;
-    return crom_.at(src);
+    size_t offset = romOffset(src);
+    return offset < crom_->size() ? (*crom_)[offset] : 0xff;
   }
 
   static_assert(MemSize::kVideoRAM < MemAddr::kCartridgeRAM);
 
   if (src < (MemAddr::kVideoRAM + MemSize::kVideoRAM)) {
-    src -= MemAddr::kVideoRAM;
-    return vram_.at(src);
+    return pages_[ramPage(src)][src & 0xff];
   }
 
   static_assert(MemAddr::kCartridgeRAM < MemAddr::kLowRAM);
 
   if (src < (MemAddr::kCartridgeRAM + MemSize::kCartridgeRAM)) {
-    src -= MemAddr::kCartridgeRAM;
-    return cram_.at(src);
+    if (rtcSelected()) {
+      u8 reg = ramBank_ - kRtcSeconds;
+      return (ramEnabled_ && reg < sizeof(rtcLatched_)) ? rtcLatched_[reg]
+                                                        : 0xff;
+    }
+    size_t offset = ramOffset(src);
+    if (!ramEnabled_ || offset >= ramSize_) {
+      return 0xff;
+    }
+    return cramPages_[offset / kPageSize][offset % kPageSize];
   }
 
   static_assert(MemAddr::kLowRAM < MemAddr::kEchoRAM);
 
   if (src < (MemAddr::kLowRAM + MemSize::kLowRAM)) {
-    src -= MemAddr::kLowRAM;
-    return lram_.at(src);
+    return pages_[ramPage(src)][src & 0xff];
   }
 
   static_assert(MemAddr::kEchoRAM < MemAddr::kOamRAM);
 
   if (src < (MemAddr::kEchoRAM + MemSize::kEchoRAM)) {
-    src -= MemAddr::kEchoRAM;
-    return lram_.at(src);
+    return pages_[ramPage(src)][src & 0xff];
   }
 
   static_assert(MemAddr::kOamRAM < MemAddr::kInvRAM);
 
   if (src < (MemAddr::kOamRAM + MemSize::kOamRAM)) {
+    if (clock_ < dmaEnd_) {
+      // busy with dma
+      return 0xff;
+    }
     src -= MemAddr::kOamRAM;
-    return oram_.at(src);
+    return oram_[src];
   }
 
   static_assert(MemAddr::kInvRAM < MemAddr::kHwIO);
@@ -143,12 +849,17 @@ u8 MMUImpl::read(addr_t src) {
 
   if (src < (MemAddr::kHwIO + MemSize::kHwIO)) {
     src -= MemAddr::kHwIO;
-    return hwio_.at(src);
+    return ioHandlers_[src].read(ioHandlers_[src].owner, src);
+  }
+
+  if (src == Address::HwIoInterruptSwitch) {
+    const IoHandler &handler = ioHandlers_[kIoInterruptSwitch];
+    return handler.read(handler.owner, kIoInterruptSwitch);
   }
 
   if (src) {
     src -= MemAddr::kHighRAM;
-    return hram_.at(src);
+    return hram_[src];
   }
 
   assert(false);
@@ -156,107 +867,147 @@ u8 MMUImpl::read(addr_t src) {
   return 0xff;
 }
 
+u8 MMUImpl::read(addr_t src) {
+  // watched pages are never mapped
+  if (const u8 *page = reads_[src >> 8]) {
+    return page[src & 0xff];
+  }
+  u8 value = loadSlow(src);
+  if (watchPages_[src >> 8]) {
+    watch(src, value, kWatchRead);
+  }
+  return value;
+}
+
+void MMUImpl::write(addr_t dst, u8 value) {
+  if (u8 *page = writes_[dst >> 8]) {
+    page[dst & 0xff] = value;
+    return;
+  }
+  if (watchPages_[dst >> 8]) {
+    watch(dst, value, kWatchWrite);
+  }
+  storeSlow(dst, value);
+}
+
 static const ticks_t kTimerFrequencies[4] = {4096, 262144, 65536, 16384};
 
 static const ticks_t kTimerDuration[4] = {
     kClockRate / kTimerFrequencies[0], kClockRate / kTimerFrequencies[1],
     kClockRate / kTimerFrequencies[2], kClockRate / kTimerFrequencies[3]};
 
-static const ticks_t kDividerDuration = 16384;
-
-static const u8 kHwIoIndexTimerDivider = 0x04;
-static const u8 kHwIoIndexTimerCounter = 0x05;
-static const u8 kHwIoIndexTimerModulo = 0x06;
-static const u8 kHwIoIndexTimerControl = 0x07;
-static const u8 kHwIoIndexInterruptFlag = 0x0f;
-
 static const u8 kTimerControlStartFlag = 0x04;
 static const u8 kTimerControlClockSelectMask = 0x03;
 
 void MMUImpl::step(ticks_t ticks) {
-  // Todo: DMA
-
-  // Divider
-  divider_ += ticks;
-  if (divider_ >= kDividerDuration) {
-    divider_ -= kDividerDuration;
-    hwio_.at(kHwIoIndexTimerDivider) += 1;
+  clock_ += ticks;
+  // long steps (halt, fast timers with TMA near 0xff) span more than one
+  while (clock_ >= timerEvent_) {
+    timerOverflow();
   }
+}
 
-  // Timer
-  u8 timerControl = hwio_.at(kHwIoIndexTimerControl);
-  u8 timerRunning = timerControl & kTimerControlStartFlag;
-  if (timerRunning) {
-    u8 clockSelect = timerControl & kTimerControlClockSelectMask;
+// 160 m-cycles
+static const ticks_t kDmaDuration = 640;
 
-    timer_ += ticks;
-    if (timer_ >= kTimerDuration[clockSelect]) {
-      timer_ -= kTimerDuration[clockSelect];
-      hwio_.at(kHwIoIndexTimerCounter) += 1;
+void MMUImpl::transfer(addr_t dst, addr_t src) {
+  assert(dst == MemAddr::kOamRAM);
+  UNUSED(dst);
 
-      if (hwio_.at(kHwIoIndexTimerCounter) == 0) {
-        hwio_.at(kHwIoIndexInterruptFlag) |= kTimerOverflowInterrupt;
-        hwio_.at(kHwIoIndexTimerCounter) = hwio_.at(kHwIoIndexTimerModulo);
-      }
-    }
+  // sources above low ram read its echo
+  if (src >= MemAddr::kEchoRAM) {
+    src -= MemAddr::kEchoRAM - MemAddr::kLowRAM;
+  }
+
+  const u8 *page = reads_[src >> 8];
+  if (page && (src & 0xff) + MemSize::kOamRAM <= kPageSize) {
+    std::memcpy(oram_.data(), page + (src & 0xff), MemSize::kOamRAM);
   } else {
-    timer_ = 0;
+    for (addr_t i = 0; i < MemSize::kOamRAM; i++) {
+      oram_[i] = loadSlow(src + i);
+    }
   }
+  dmaEnd_ = clock_ + kDmaDuration;
+  touch(MemAddr::kOamRAM >> 8);
+  GBG_LOG(kLogTrace, kLogDma, clock_, "oam dma from {x}", src);
 }
 
-void MMUImpl::transfer(addr_t dst, addr_t src) {
-  std::cout << "dma: src=" << std::hex << static_cast<u32>(src)
-            << " dst=" << static_cast<u32>(dst) << "\n";
-  for (addr_t i = 0; i < 160; i++) {
-    write(dst + i, read(src + i));
+void MMUImpl::writeDma(u8 index, u8 value) {
+  hwio_[index] = value;
+  transfer(MemAddr::kOamRAM, value << 8);
+}
+
+void MMUImpl::store(addr_t dst, u8 value) {
+  if (u8 *page = writes_[dst >> 8]) {
+    page[dst & 0xff] = value;
+    return;
   }
+  storeSlow(dst, value);
 }
 
-void MMUImpl::write(addr_t dst, u8 value) {
+void MMUImpl::storeSlow(addr_t dst, u8 value) {
   static_assert(MemSize::kCartridgeRAM < MemAddr::kVideoRAM);
 
   if (dst < (MemAddr::kCartridgeROM + MemSize::kCartridgeROM)) {
-    // read only
+    // read only, writes reach the bank controller
+    writeMbc(dst, value);
     return;
   }
 
   static_assert(MemSize::kVideoRAM < MemAddr::kCartridgeRAM);
 
   if (dst < (MemAddr::kVideoRAM + MemSize::kVideoRAM)) {
-    dst -= MemAddr::kVideoRAM;
-    vram_.at(dst) = value;
+    ram(dst) = value;
     return;
   }
 
   static_assert(MemAddr::kCartridgeRAM < MemAddr::kLowRAM);
 
   if (dst < (MemAddr::kCartridgeRAM + MemSize::kCartridgeRAM)) {
-    dst -= MemAddr::kCartridgeRAM;
-    cram_.at(dst) = value;
+    if (rtcSelected()) {
+      u8 reg = ramBank_ - kRtcSeconds;
+      if (ramEnabled_ && reg < sizeof(rtcLatched_)) {
+        writeRtc(reg, value);
+      }
+      return;
+    }
+    size_t offset = ramOffset(dst);
+    if (ramEnabled_ && offset < ramSize_) {
+      size_t index = offset / kPageSize;
+      if (cramWritable_[index] == nullptr) {
+        ownCram(index);
+        map(dst >> 8);
+      }
+      touch(dst >> 8);
+      cramWritable_[index][offset % kPageSize] = value;
+    }
     return;
   }
 
   static_assert(MemAddr::kLowRAM < MemAddr::kEchoRAM);
 
   if (dst < (MemAddr::kLowRAM + MemSize::kLowRAM)) {
-    dst -= MemAddr::kLowRAM;
-    lram_.at(dst) = value;
+    ram(dst) = value;
     return;
   }
 
   static_assert(MemAddr::kEchoRAM < MemAddr::kOamRAM);
 
   if (dst < (MemAddr::kEchoRAM + MemSize::kEchoRAM)) {
-    dst -= MemAddr::kEchoRAM;
-    lram_.at(dst) = value;
+    ram(dst) = value;
     return;
   }
 
   static_assert(MemAddr::kOamRAM < MemAddr::kInvRAM);
 
   if (dst < (MemAddr::kOamRAM + MemSize::kOamRAM)) {
+    if (clock_ < dmaEnd_) {
+      // busy with dma
+      return;
+    }
+    touch(MemAddr::kOamRAM >> 8);
     dst -= MemAddr::kOamRAM;
-    oram_.at(dst) = value;
+    oram_[dst] = value;
     return;
   }
 
@@ -270,28 +1021,443 @@ void MMUImpl::write(addr_t dst, u8 value) {
   static_assert(MemAddr::kHwIO < MemAddr::kHighRAM);
 
   if (dst < (MemAddr::kHwIO + MemSize::kHwIO)) {
+    touch(MemAddr::kHwIO >> 8);
     dst -= MemAddr::kHwIO;
+    ioHandlers_[dst].write(ioHandlers_[dst].owner, dst, value);
+    return;
+  }
 
-    if (dst == kHwIoIndexTimerDivider) {
-      hwio_.at(dst) = 0;
+  if (dst == Address::HwIoInterruptSwitch) {
+    touch(MemAddr::kHighRAM >> 8);
+    const IoHandler &handler = ioHandlers_[kIoInterruptSwitch];
+    handler.write(handler.owner, kIoInterruptSwitch, value);
+    return;
+  }
+
+  if (dst) {
+    touch(MemAddr::kHighRAM >> 8);
+    dst -= MemAddr::kHighRAM;
+    hram_[dst] = value;
+    return;
+  }
+
+  assert(false);
+}
+
+u8 MMUImpl::zread(u8 offset) {
+  static_assert(MemAddr::kHwIO + MemSize::kHwIO == MemAddr::kHighRAM);
+
+  u8 value;
+  if (offset < MemSize::kHwIO || offset == 0xff) {
+    u8 index = (offset == 0xff) ? kIoInterruptSwitch : offset;
+    value = ioHandlers_[index].read(ioHandlers_[index].owner, index);
+  } else {
+    value = hram_[offset - MemSize::kHwIO];
+  }
+
+  if (watchPages_[MemAddr::kHwIO >> 8]) {
+    watch(MemAddr::kHwIO + offset, value, kWatchRead);
+  }
+  return value;
+}
+
+void MMUImpl::zwrite(u8 offset, u8 value) {
+  if (watchPages_[MemAddr::kHwIO >> 8]) {
+    watch(MemAddr::kHwIO + offset, value, kWatchWrite);
+  }
+  touch(MemAddr::kHwIO >> 8);
+
+  if (offset < MemSize::kHwIO || offset == 0xff) {
+    u8 index = (offset == 0xff) ? kIoInterruptSwitch : offset;
+    ioHandlers_[index].write(ioHandlers_[index].owner, index, value);
+    return;
+  }
+  hram_[offset - MemSize::kHwIO] = value;
+}
+
+const u8 *MMUImpl::stack(addr_t sp) const {
+  // Both bytes of the word must lie into the same ram page, interrupt switch
+  // (0xffff) is excluded as it is not plain memory.
+  if (sp >= MemAddr::kLowRAM &&
+      sp < (MemAddr::kLowRAM + MemSize::kLowRAM - 1)) {
+    if (watchPages_[sp >> 8] || (sp & 0xff) == 0xff) {
+      return nullptr;
+    }
+    return pages_[ramPage(sp)] + (sp & 0xff);
+  }
+  if (sp >= MemAddr::kHighRAM && sp < (Address::HwIoInterruptSwitch - 1)) {
+    if (watchPages_[sp >> 8]) {
+      return nullptr;
+    }
+    return &hram_[sp - MemAddr::kHighRAM];
+  }
+  return nullptr;
+}
+
+u8 *MMUImpl::writableStack(addr_t sp) {
+  // pages are owned and marked written only here, pops read shared pages
+  if (stack(sp) == nullptr) {
+    return nullptr;
+  }
+  if (sp < MemAddr::kHighRAM) {
+    return &ram(sp);
+  }
+  touch(sp >> 8);
+  return &hram_[sp - MemAddr::kHighRAM];
+}
+
+void MMUImpl::push(addr_t &sp, u16 value) {
+  // Stack words are stored high byte first at sp - 1, when backed by host
+  // memory the two byte accesses are merged into a single 16-bit store.
+  u8 *top = writableStack(sp - 1);
+  if (top != nullptr) {
+    top[0] = value >> 8;
+    top[1] = value & 0xff;
+  } else {
+    write(sp, value & 0xff);
+    write(sp - 1, value >> 8);
+  }
+  sp -= 2;
+}
+
+u16 MMUImpl::pop(addr_t &sp) {
+  u16 value;
+  const u8 *top = stack(sp + 1);
+  if (top != nullptr) {
+    value = (top[0] << 8) | top[1];
+  } else {
+    value = (read(sp + 1) << 8) | read(sp + 2);
+  }
+  sp += 2;
+  return value;
+}
+
+const u8 *MMUImpl::window(addr_t src, addr_t &begin, addr_t &end) {
+  if (src < (MemAddr::kBiosROM + MemSize::kBiosROM) &&
+      hwio_[kHwIoIndexBootLatch] != 1) {
+    begin = MemAddr::kBiosROM;
+    end = MemAddr::kBiosROM + MemSize::kBiosROM;
+    return bios_->data();
+  }
+
+  if (src < (MemAddr::kCartridgeROM + MemSize::kCartridgeROM)) {
+    // window is the rom bank of src, the upper one switches
+    begin = src & ~(kRomBankSize - 1);
+    if (begin == MemAddr::kBiosROM && hwio_[kHwIoIndexBootLatch] != 1) {
+      begin += MemSize::kBiosROM;
+    }
+    size_t offset = romOffset(begin);
+    if (offset >= crom_->size()) {
+      return nullptr;
+    }
+    size_t bankEnd = (begin & ~(kRomBankSize - 1)) + kRomBankSize;
+    end = begin + std::min(bankEnd - begin, crom_->size() - offset);
+    if (src >= end) {
+      return nullptr;
+    }
+    return crom_->data() + offset;
+  }
+
+  if (src >= MemAddr::kCartridgeRAM &&
+      src < (MemAddr::kCartridgeRAM + MemSize::kCartridgeRAM)) {
+    begin = src & ~(kPageSize - 1);
+    end = begin + kPageSize;
+    size_t offset = ramOffset(begin);
+    if (!ramEnabled_ || rtcSelected() || offset + kPageSize > ramSize_) {
+      return nullptr;
+    }
+    return cramPages_[offset / kPageSize];
+  }
+
+  if (src < (MemAddr::kEchoRAM + MemSize::kEchoRAM)) {
+    // ram pages are not contiguous, window is the page of src
+    begin = src & ~(kPageSize - 1);
+    end = begin + kPageSize;
+    return pages_[ramPage(begin)];
+  }
+
+  if (src < (MemAddr::kOamRAM + MemSize::kOamRAM)) {
+    begin = MemAddr::kOamRAM;
+    end = MemAddr::kOamRAM + MemSize::kOamRAM;
+    return oram_.data();
+  }
+
+  if (src >= MemAddr::kHighRAM && src < Address::HwIoInterruptSwitch) {
+    begin = MemAddr::kHighRAM;
+    end = Address::HwIoInterruptSwitch;
+    return hram_.data();
+  }
+
+  return nullptr;
+}
+
+void MMUImpl::addWatchpoint(addr_t addr, u8 kind) {
+  for (auto &w : watchpoints_) {
+    if (w.addr == addr) {
+      w.kind = kind;
       return;
     }
+  }
+  watchpoints_.push_back({addr, kind, 0});
+  watchPages_[addr >> 8] += 1;
+  map(addr >> 8);
+}
 
-    if (dst == 0x50) {
-      std::cout << "bios write: " << static_cast<int>(value) << "\n";
+bool MMUImpl::removeWatchpoint(addr_t addr) {
+  for (auto it = watchpoints_.begin(); it != watchpoints_.end(); it++) {
+    if (it->addr == addr) {
+      watchpoints_.erase(it);
+      watchPages_[addr >> 8] -= 1;
+      map(addr >> 8);
+      return true;
     }
+  }
+  return false;
+}
 
-    hwio_.at(dst) = value;
-    return;
+const std::vector<Watchpoint> &MMUImpl::watchpoints() const {
+  return watchpoints_;
+}
+
+const Watchpoint &MMUImpl::watchHit() const { return watchHit_; }
+
+void MMUImpl::watch(addr_t addr, u8 value, u8 kind) {
+  for (auto &w : watchpoints_) {
+    if (w.addr == addr && (w.kind & kind)) {
+      w.value = value;
+      watchHit_ = {addr, kind, value};
+      trapped_ = true;
+      // drop cpu out of its fetch window so that it notices the trap
+      generation_++;
+      return;
+    }
   }
+}
 
-  if (dst) {
-    dst -= MemAddr::kHighRAM;
-    hram_.at(dst) = value;
+void MMUImpl::setIoHandler(u8 index, const IoHandler &handler) {
+  assert(index < kIoRegisters);
+  ioHandlers_[index] = handler;
+}
+
+u8 MMUImpl::readIo(u8 index) { return io(index); }
+
+void MMUImpl::writeIo(u8 index, u8 value) { io(index) = value; }
+
+u8 MMUImpl::readDivider(u8 index) {
+  UNUSED(index);
+  return (clock_ - divBase_) >> 8;
+}
+
+void MMUImpl::writeDivider(u8 index, u8 value) {
+  UNUSED(value);
+  // Resetting the system counter is a falling edge when the bit the timer
+  // watches was set
+  bool signal = timerSignal();
+  rebaseTimer();
+  divBase_ = clock_;
+  hwio_[index] = 0;
+  if (signal) {
+    tickTimer();
+  }
+  scheduleTimer();
+}
+
+u8 MMUImpl::readTimerCounter(u8 index) {
+  UNUSED(index);
+  return timerCounter();
+}
+
+void MMUImpl::writeTimerCounter(u8 index, u8 value) {
+  UNUSED(index);
+  rebaseTimer();
+  tima_ = value;
+  scheduleTimer();
+}
+
+void MMUImpl::writeTimerControl(u8 index, u8 value) {
+  // Disabling the timer or selecting a clear bit is a falling edge too
+  bool signal = timerSignal();
+  rebaseTimer();
+  hwio_[index] = value;
+  if (signal && !timerSignal()) {
+    tickTimer();
+  }
+  scheduleTimer();
+}
+
+u8 MMUImpl::timerCounter() const {
+  u8 control = hwio_[kHwIoIndexTimerControl];
+  if (!(control & kTimerControlStartFlag)) {
+    return tima_;
+  }
+
+  // TIMA counts the falling edges of a system counter bit, one every
+  // duration cycles
+  ticks_t duration = kTimerDuration[control & kTimerControlClockSelectMask];
+  return tima_ + (clock_ - divBase_) / duration -
+         (timaBase_ - divBase_) / duration;
+}
+
+bool MMUImpl::timerSignal() const {
+  u8 control = hwio_[kHwIoIndexTimerControl];
+  ticks_t duration = kTimerDuration[control & kTimerControlClockSelectMask];
+  return (control & kTimerControlStartFlag) &&
+         ((clock_ - divBase_) & (duration / 2));
+}
+
+void MMUImpl::loadTimer(ticks_t counter) {
+  divBase_ = clock_ - counter;
+  timaBase_ = clock_;
+  tima_ = hwio_[kHwIoIndexTimerCounter];
+  scheduleTimer();
+}
+
+void MMUImpl::rebaseTimer() {
+  tima_ = timerCounter();
+  timaBase_ = clock_;
+}
+
+void MMUImpl::scheduleTimer() {
+  u8 control = hwio_[kHwIoIndexTimerControl];
+  if (!(control & kTimerControlStartFlag)) {
+    timerEvent_ = std::numeric_limits<ticks_t>::max();
     return;
   }
 
-  assert(false);
+  ticks_t duration = kTimerDuration[control & kTimerControlClockSelectMask];
+  ticks_t edges = (timaBase_ - divBase_) / duration + (0x100 - tima_);
+  timerEvent_ = divBase_ + edges * duration;
+}
+
+void MMUImpl::tickTimer() {
+  tima_ += 1;
+  if (tima_ == 0) {
+    tima_ = hwio_[kHwIoIndexTimerModulo];
+    hwio_[kHwIoIndexInterruptFlag] |= kTimerOverflowInterrupt;
+  }
+}
+
+void MMUImpl::timerOverflow() {
+  // reload as of the overflow edge, later edges keep counting
+  timaBase_ = timerEvent_;
+  tima_ = hwio_[kHwIoIndexTimerModulo];
+  hwio_[kHwIoIndexInterruptFlag] |= kTimerOverflowInterrupt;
+  scheduleTimer();
+}
+
+void MMUImpl::writeBootLatch(u8 index, u8 value) {
+  GBG_LOG(kLogInfo, kLogMemory, clock_, "boot rom latch {}", value);
+  bool remap = (hwio_[index] == 1) != (value == 1);
+  hwio_[index] = value;
+  if (remap) {
+    // swap the boot rom page for the cartridge one, or back
+    map(MemAddr::kBiosROM >> 8);
+    generation_++;
+  }
+}
+
+static const u8 kJoypadSelectDirections = 1 << 4;
+static const u8 kJoypadSelectButtons = 1 << 5;
+
+u8 MMUImpl::readJoypad(u8 index) {
+  // Lines are active low, unused bits read as set
+  u8 select = hwio_[index];
+  u8 pressed = 0;
+  if ((select & kJoypadSelectDirections) == 0) {
+    pressed |= buttons_ & 0x0f;
+  }
+  if ((select & kJoypadSelectButtons) == 0) {
+    pressed |= buttons_ >> 4;
+  }
+  return 0xc0 | (select & 0x30) | (~pressed & 0x0f);
+}
+
+void MMUImpl::writeJoypad(u8 index, u8 value) {
+  // only select lines are writable
+  u8 lines = readJoypad(index);
+  hwio_[index] = value & (kJoypadSelectDirections | kJoypadSelectButtons);
+  joypadInterrupt(lines);
+}
+
+void MMUImpl::joypadInterrupt(u8 lines) {
+  // high to low transition of any input line
+  if (lines & ~readJoypad(kHwIoIndexJoypad) & 0x0f) {
+    hwio_[kHwIoIndexInterruptFlag] |= kJoypadReleaseInterrupt;
+  }
 }
 
-buffer_t &MMUImpl::getOAM() { return oram_; }
\ No newline at end of file
+std::array<u8, MemSize::kOamRAM> &MMUImpl::getOAM() { return oram_; }
+
+// State starts with the ram pages, then the arena
+static const size_t kArenaSize =
+    MemSize::kOamRAM + MemSize::kHwIO + MemSize::kHighRAM;
+
+void MMUImpl::save(State &state, u8 *cram) const {
+  static_assert(offsetof(State, lram) ==
+                offsetof(State, vram) + MemSize::kVideoRAM);
+  static_assert(offsetof(State, hwio) - offsetof(State, oram) ==
+                offsetof(Arena, hwio));
+  static_assert(offsetof(State, hram) - offsetof(State, oram) ==
+                offsetof(Arena, hram));
+
+  // pages not written since the last fork live in shared blocks
+  for (size_t i = 0; i < kPages; i++) {
+    std::memcpy(state.vram.data() + i * kPageSize, pages_[i], kPageSize);
+  }
+  std::memcpy(state.oram.data(), arena_.get(), kArenaSize);
+
+  // lazy registers as they read now
+  state.hwio[kHwIoIndexTimerDivider] = (clock_ - divBase_) >> 8;
+  state.hwio[kHwIoIndexTimerCounter] = timerCounter();
+  state.divider = (clock_ - divBase_) & 0xffff;
+  state.dma = (clock_ < dmaEnd_) ? dmaEnd_ - clock_ : 0;
+  state.buttons = buttons_;
+
+  state.romBank = romBank_;
+  state.ramBank = ramBank_;
+  state.ramEnabled = ramEnabled_;
+  state.bankMode = bankMode_;
+  if (cram != nullptr) {
+    for (size_t i = 0; i < cramPages_.size(); i++) {
+      std::memcpy(cram + i * kPageSize, cramPages_[i], kPageSize);
+    }
+  }
+
+  state.rtc = rtcCycles();
+  state.rtcHost = (rtcClock_ == kRtcHost) ? rtcNow() : 0;
+  state.rtcHalt = rtcHalt_;
+  state.rtcCarry = rtcCarry_;
+  state.rtcLatch = rtcLatch_;
+  std::copy_n(rtcLatched_, sizeof(rtcLatched_), state.rtcLatched.begin());
+}
+
+void MMUImpl::restore(const State &state, const u8 *cram) {
+  RamBlock &ram = ownAll();
+  std::memcpy(ram.vram.data(), state.vram.data(), kPages * kPageSize);
+  std::memcpy(arena_.get(), state.oram.data(), kArenaSize);
+  if (cram != nullptr && ramSize_ > 0) {
+    std::memcpy(ownAllCram().data(), cram, ramSize_);
+  }
+  romBank_ = state.romBank;
+  ramBank_ = state.ramBank;
+  ramEnabled_ = state.ramEnabled;
+  bankMode_ = state.bankMode;
+
+  // a host clock keeps counting the time since the save
+  rtcBase_ = state.rtc;
+  rtcEpoch_ = (rtcClock_ == kRtcHost && state.rtcHost) ? state.rtcHost
+                                                       : rtcNow();
+  rtcHalt_ = state.rtcHalt;
+  rtcCarry_ = state.rtcCarry;
+  rtcLatch_ = state.rtcLatch;
+  std::copy_n(state.rtcLatched.begin(), sizeof(rtcLatched_), rtcLatched_);
+  std::fill_n(dirty_, 0x100, dirtyGeneration_);
+  mapAll();
+
+  loadTimer(state.divider);
+  dmaEnd_ = clock_ + state.dma;
+  buttons_ = state.buttons;
+
+  trapped_ = false;
+  generation_++;
+}
\ No newline at end of file
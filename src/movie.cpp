@@ -0,0 +1,190 @@
+/*
+ * movie.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "movie.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+using namespace gbg;
+
+static const u32 kMovieMagic = 0x4d424247; // GBBM
+static const u32 kMovieVersion = 1;
+
+struct MovieHeader {
+  u32 magic;
+  u32 version;
+  u32 stateVersion;
+  u32 stateSize; // of every keyframe, the cartridge ram included
+  u64 romHash;
+  u32 interval;
+  u32 frames;
+  u32 keyframes;
+};
+
+Movie::Movie()
+    : romHash_(0), interval_(600), frame_(0), inputs_(), keyframes_() {}
+
+u64 Movie::hash(const buffer_t &rom) {
+  // FNV-1a
+  u64 hash = 0xcbf29ce484222325;
+  for (u8 byte : rom) {
+    hash = (hash ^ byte) * 0x100000001b3;
+  }
+  return hash;
+}
+
+void Movie::record(Emulator &emulator, u32 interval) {
+  romHash_ = hash(emulator.getMMU().cartridge());
+  interval_ = interval ? interval : 1;
+  frame_ = 0;
+  inputs_.clear();
+  keyframes_.clear();
+}
+
+void Movie::recordFrame(Emulator &emulator, u8 buttons) {
+  if (frame_ < inputs_.size()) {
+    // rerecording, drop the future
+    inputs_.resize(frame_);
+    while (!keyframes_.empty() && keyframes_.back().frame >= frame_) {
+      keyframes_.pop_back();
+    }
+  }
+
+  if (frame_ % interval_ == 0) {
+    Keyframe keyframe{frame_, buffer_t()};
+    emulator.save(keyframe.state);
+    keyframes_.push_back(std::move(keyframe));
+  }
+
+  emulator.setButtons(buttons);
+  emulator.nextFrame();
+  inputs_.push_back(buttons);
+  frame_++;
+}
+
+bool Movie::playFrame(Emulator &emulator) {
+  if (frame_ >= inputs_.size()) {
+    return false;
+  }
+
+  emulator.setButtons(inputs_[frame_]);
+  emulator.nextFrame();
+  frame_++;
+  return true;
+}
+
+void Movie::seek(Emulator &emulator, u32 frame) {
+  check(emulator);
+  if (keyframes_.empty()) {
+    throw std::runtime_error("error: empty movie");
+  }
+
+  // start far enough back to render the whole frame shown at frame
+  frame = std::min(frame, frames());
+  const u32 render = emulator.renderFrames();
+  const u32 start = frame >= render ? frame - render : 0;
+  auto keyframe = std::upper_bound(
+      keyframes_.begin(), keyframes_.end(), start,
+      [](u32 f, const Keyframe &k) { return f < k.frame; });
+  --keyframe;
+
+  emulator.load(keyframe->state);
+  frame_ = keyframe->frame;
+
+  while (frame_ < frame) {
+    emulator.setRendering(frame - frame_ <= render);
+    playFrame(emulator);
+  }
+  emulator.setRendering(true);
+}
+
+u32 Movie::frame() const { return frame_; }
+
+u32 Movie::frames() const { return inputs_.size(); }
+
+void Movie::check(Emulator &emulator) const {
+  if (hash(emulator.getMMU().cartridge()) != romHash_) {
+    throw std::runtime_error("error: movie recorded with another cartridge");
+  }
+}
+
+void Movie::save(const std::string &path) const {
+  std::ofstream file(path, std::ios::binary);
+
+  size_t stateSize = keyframes_.empty() ? 0 : keyframes_.front().state.size();
+  MovieHeader header = {kMovieMagic,
+                        kMovieVersion,
+                        Emulator::kStateVersion,
+                        static_cast<u32>(stateSize),
+                        romHash_,
+                        interval_,
+                        static_cast<u32>(inputs_.size()),
+                        static_cast<u32>(keyframes_.size())};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(inputs_.data()), inputs_.size());
+  for (auto &keyframe : keyframes_) {
+    file.write(reinterpret_cast<const char *>(&keyframe.frame),
+               sizeof(keyframe.frame));
+    file.write(reinterpret_cast<const char *>(keyframe.state.data()),
+               keyframe.state.size());
+  }
+
+  if (!file) {
+    throw std::runtime_error("error: cannot write movie");
+  }
+}
+
+void Movie::load(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+
+  MovieHeader header = MovieHeader();
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || header.magic != kMovieMagic ||
+      header.version != kMovieVersion) {
+    throw std::runtime_error("error: invalid movie file");
+  }
+  if (header.stateVersion != Emulator::kStateVersion ||
+      header.stateSize < sizeof(Emulator::State)) {
+    throw std::runtime_error("error: incompatible movie state version");
+  }
+
+  // sizes come from the file, check them against it before allocating
+  auto begin = file.tellg();
+  file.seekg(0, std::ios::end);
+  u64 size = file.tellg() - begin;
+  file.seekg(begin);
+  u64 keyframeSize = sizeof(u32) + static_cast<u64>(header.stateSize);
+  if (!file || header.frames > size ||
+      header.keyframes > (size - header.frames) / keyframeSize) {
+    throw std::runtime_error("error: truncated movie file");
+  }
+
+  std::vector<u8> inputs(header.frames);
+  file.read(reinterpret_cast<char *>(inputs.data()), inputs.size());
+
+  std::vector<Keyframe> keyframes;
+  for (u32 i = 0; i < header.keyframes && file; i++) {
+    Keyframe keyframe{0, buffer_t(header.stateSize)};
+    file.read(reinterpret_cast<char *>(&keyframe.frame),
+              sizeof(keyframe.frame));
+    file.read(reinterpret_cast<char *>(keyframe.state.data()),
+              keyframe.state.size());
+    keyframes.push_back(std::move(keyframe));
+  }
+
+  if (!file || keyframes.empty() || keyframes.front().frame != 0) {
+    throw std::runtime_error("error: truncated movie file");
+  }
+
+  romHash_ = header.romHash;
+  interval_ = header.interval;
+  frame_ = 0;
+  inputs_ = std::move(inputs);
+  keyframes_ = std::move(keyframes);
+}
@@ -0,0 +1,132 @@
+/*
+ * pacer.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "pacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+using namespace gbg;
+using namespace std::chrono;
+
+static const auto kInitialSlack = microseconds(1000);
+static const auto kMinSlack = microseconds(50);
+
+Pacer::Pacer(u8 fps)
+    : period_(duration_cast<Clock::duration>(nanoseconds(1'000'000'000) /
+                                             fps)),
+      pacing_(kPacingHybrid), deadline_(Clock::now()), last_(Clock::now()),
+      slack_(kInitialSlack), samples_(), sampled_(0), vsyncTs_(0),
+      vsyncPeriod_(0) {}
+
+void Pacer::setPacing(Pacing pacing) { pacing_ = pacing; }
+
+Pacing Pacer::pacing() const { return pacing_; }
+
+void Pacer::wait() {
+  auto now = Clock::now();
+  auto next = deadline_ + period_;
+
+  s64 vsyncPeriod = vsyncPeriod_.load(std::memory_order_relaxed);
+  if (pacing_ == kPacingVsync && vsyncPeriod > 0) {
+    // first refresh after the previous deadline, skipping one that is too
+    // close to it to be a different refresh
+    auto period = nanoseconds(vsyncPeriod);
+    auto vsync = Clock::time_point(duration_cast<Clock::duration>(
+        nanoseconds(vsyncTs_.load(std::memory_order_relaxed))));
+    auto earliest = deadline_ + period / 2;
+    if (vsync < earliest) {
+      vsync += ((earliest - vsync) / period + 1) * period;
+    }
+    next = vsync;
+  }
+
+  if (next < now - period_) {
+    // fell behind by more than a frame, do not try to catch up
+    next = now;
+  }
+  deadline_ = next;
+
+  sleepUntil(deadline_);
+  record();
+}
+
+void Pacer::mark() {
+  deadline_ = Clock::now();
+  record();
+}
+
+void Pacer::sleepUntil(Clock::time_point deadline) {
+  auto wake = deadline - slack_;
+  auto now = Clock::now();
+  if (now < wake) {
+    std::this_thread::sleep_for(wake - now);
+
+    // slack follows the worst recent oversleep, decaying slowly
+    auto oversleep = Clock::now() - wake;
+    slack_ = std::max<Clock::duration>(slack_ - slack_ / 64, kMinSlack);
+    slack_ = std::max<Clock::duration>(slack_, oversleep + oversleep / 4);
+    slack_ = std::min<Clock::duration>(slack_, period_ / 2);
+  }
+
+  while (Clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+}
+
+void Pacer::record() {
+  auto now = Clock::now();
+  samples_[sampled_ % kSamples] =
+      duration_cast<duration<float, std::milli>>(now - last_).count();
+  sampled_++;
+  last_ = now;
+}
+
+void Pacer::vsync() {
+  s64 now = duration_cast<nanoseconds>(Clock::now().time_since_epoch()).count();
+  s64 last = vsyncTs_.exchange(now, std::memory_order_relaxed);
+  if (last == 0) {
+    return;
+  }
+
+  // smoothed, ignoring missed refreshes
+  s64 interval = now - last;
+  s64 period = vsyncPeriod_.load(std::memory_order_relaxed);
+  if (period == 0) {
+    period = interval;
+  } else if (interval < period + period / 2) {
+    period += (interval - period) / 16;
+  }
+  vsyncPeriod_.store(period, std::memory_order_relaxed);
+}
+
+float Pacer::refreshRate() const {
+  s64 period = vsyncPeriod_.load(std::memory_order_relaxed);
+  return period > 0 ? 1e9f / period : 0;
+}
+
+Pacer::Stats Pacer::stats() const {
+  Stats stats = Stats();
+  stats.slack = duration_cast<duration<float, std::milli>>(slack_).count();
+
+  size_t count = std::min(sampled_, kSamples);
+  if (count == 0) {
+    return stats;
+  }
+
+  std::array<float, kSamples> sorted = samples_;
+  std::sort(sorted.begin(), sorted.begin() + count);
+  stats.p50 = sorted[count * 50 / 100];
+  stats.p95 = sorted[count * 95 / 100];
+  stats.p99 = sorted[count * 99 / 100];
+
+  for (size_t i = 0; i < count; i++) {
+    size_t bucket = std::min<size_t>(sorted[i], kHistogramBuckets - 1);
+    stats.histogram[bucket] += 1;
+  }
+  return stats;
+}
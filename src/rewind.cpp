@@ -0,0 +1,194 @@
+/*
+ * rewind.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "rewind.hpp"
+
+#include <cstring>
+
+using namespace gbg;
+
+static const size_t kMaxRun = 0xffff;
+
+// zero run shorter than this is cheaper kept as literals than as a new run
+static const size_t kMinZeroRun = 4;
+
+/*
+ * Encoding is a sequence of runs, each one:
+ *   u16 zeros, u16 literals, literals bytes
+ */
+static void put16(buffer_t &out, size_t value) {
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+void Rewind::encode(const u8 *a, const u8 *b, size_t size, buffer_t &out) {
+  out.clear();
+
+  size_t i = 0;
+  while (i < size) {
+    size_t zeros = 0;
+    while (i < size && zeros < kMaxRun && a[i] == b[i]) {
+      zeros++;
+      i++;
+    }
+
+    size_t begin = i;
+    size_t literals = 0;
+    while (i < size && literals < kMaxRun) {
+      size_t same = 0;
+      while (same < kMinZeroRun && (i + same) < size &&
+             a[i + same] == b[i + same]) {
+        same++;
+      }
+      if (same == kMinZeroRun || (i + same) == size) {
+        break;
+      }
+      literals += same + 1;
+      i += same + 1;
+    }
+
+    if (literals > kMaxRun) {
+      i -= literals - kMaxRun;
+      literals = kMaxRun;
+    }
+
+    put16(out, zeros);
+    put16(out, literals);
+    for (size_t j = begin; j < begin + literals; j++) {
+      out.push_back(a[j] ^ b[j]);
+    }
+  }
+}
+
+void Rewind::decode(const u8 *in, size_t inSize, u8 *dst) {
+  const u8 *end = in + inSize;
+  while (in < end) {
+    size_t zeros = in[0] | (in[1] << 8);
+    size_t literals = in[2] | (in[3] << 8);
+    in += 4;
+
+    dst += zeros;
+    for (size_t j = 0; j < literals; j++) {
+      *dst++ ^= *in++;
+    }
+  }
+}
+
+Rewind::Rewind(size_t capacity, u32 interval)
+    : interval_(interval ? interval : 1), counter_(0), valid_(false),
+      current_(), next_(), ring_(capacity, 0), head_(0), used_(0),
+      entries_(), scratch_(), encoded_(0), captures_(0) {}
+
+void Rewind::clear() {
+  counter_ = 0;
+  valid_ = false;
+  head_ = 0;
+  used_ = 0;
+  entries_.clear();
+}
+
+void Rewind::capture(const Emulator &emulator) {
+  if (counter_++ % interval_ != 0) {
+    return;
+  }
+
+  if (!valid_) {
+    emulator.save(current_);
+    scratch_.reserve(current_.size() + (current_.size() / kMaxRun + 1) * 4);
+    valid_ = true;
+    return;
+  }
+
+  emulator.save(next_);
+  if (next_.size() != current_.size()) {
+    // cartridge with another ram size, older states cannot be restored
+    clear();
+    capture(emulator);
+    return;
+  }
+  encode(current_.data(), next_.data(), current_.size(), scratch_);
+  std::swap(current_, next_);
+
+  encoded_ += scratch_.size();
+  captures_ += 1;
+
+  u8 *dst = allocate(scratch_.size());
+  if (dst != nullptr) {
+    std::memcpy(dst, scratch_.data(), scratch_.size());
+  }
+}
+
+u8 *Rewind::allocate(size_t size) {
+  if (size > ring_.size()) {
+    // cannot be stored, history before it is lost
+    head_ = 0;
+    used_ = 0;
+    entries_.clear();
+    return nullptr;
+  }
+
+  if (head_ + size > ring_.size()) {
+    // entries past head are the oldest ones, drop them and wrap
+    while (!entries_.empty() && entries_.front().offset >= head_) {
+      used_ -= entries_.front().size;
+      entries_.pop_front();
+    }
+    head_ = 0;
+  }
+
+  while (!entries_.empty() && entries_.front().offset >= head_ &&
+         entries_.front().offset < head_ + size) {
+    used_ -= entries_.front().size;
+    entries_.pop_front();
+  }
+
+  entries_.push_back({head_, size});
+  used_ += size;
+
+  u8 *dst = ring_.data() + head_;
+  head_ += size;
+  return dst;
+}
+
+bool Rewind::step(Emulator &emulator) {
+  if (!valid_) {
+    return false;
+  }
+
+  if (entries_.empty()) {
+    emulator.load(current_);
+    return false;
+  }
+
+  auto entry = entries_.back();
+  entries_.pop_back();
+  used_ -= entry.size;
+  head_ = entry.offset;
+
+  decode(ring_.data() + entry.offset, entry.size, current_.data());
+  emulator.load(current_);
+
+  // next capture happens interval frames from the restored one
+  counter_ = 1;
+  return true;
+}
+
+u64 Rewind::frames() const {
+  return valid_ ? static_cast<u64>(entries_.size()) * interval_ : 0;
+}
+
+size_t Rewind::used() const { return used_; }
+
+size_t Rewind::capacity() const { return ring_.size(); }
+
+double Rewind::bytesPerMinute() const {
+  if (captures_ == 0) {
+    return 0;
+  }
+  const double capturesPerMinute = 60.0 * 60.0 / interval_;
+  return (static_cast<double>(encoded_) / captures_) * capturesPerMinute;
+}
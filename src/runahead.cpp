@@ -0,0 +1,61 @@
+/*
+ * runahead.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "runahead.hpp"
+
+using namespace gbg;
+using namespace std::chrono;
+
+RunAhead::RunAhead(u8 frames)
+    : frames_(frames), state_(), timing_() {}
+
+void RunAhead::setFrames(u8 frames) { frames_ = frames; }
+
+u8 RunAhead::frames() const { return frames_; }
+
+const RunAhead::Timing &RunAhead::timing() const { return timing_; }
+
+void RunAhead::nextFrame(Emulator &emulator) {
+  timing_ = Timing();
+
+  auto t0 = steady_clock::now();
+  if (frames_ == 0) {
+    emulator.nextFrame();
+    timing_.emulate = steady_clock::now() - t0;
+    return;
+  }
+
+  // the frame shown can start back in the real frame when few run ahead
+  const u32 render = emulator.renderFrames();
+  emulator.setRendering(frames_ < render);
+  emulator.nextFrame();
+  auto t1 = steady_clock::now();
+  timing_.emulate = t1 - t0;
+
+  if (emulator.stopped()) {
+    // stopped on the real timeline, nothing to look ahead of
+    emulator.setRendering(true);
+    return;
+  }
+
+  emulator.save(state_);
+  // joypad events the frames ahead take are the real frames' to apply
+  emulator.recordJoypad();
+  auto t2 = steady_clock::now();
+  timing_.save = t2 - t1;
+
+  for (u8 i = 1; i <= frames_; i++) {
+    emulator.setRendering(static_cast<u32>(frames_ - i) < render);
+    emulator.nextFrame();
+  }
+  auto t3 = steady_clock::now();
+  timing_.ahead = t3 - t2;
+
+  emulator.load(state_);
+  emulator.replayJoypad();
+  timing_.restore = steady_clock::now() - t3;
+}
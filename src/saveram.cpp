@@ -0,0 +1,88 @@
+/*
+ * saveram.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "saveram.hpp"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace gbg;
+
+SaveRam::SaveRam() : data_(nullptr), size_(0), fd_(-1) {}
+
+SaveRam::~SaveRam() { unmap(); }
+
+void SaveRam::map(const std::string &path, size_t size) {
+  unmap();
+  if (size == 0) {
+    return;
+  }
+
+  if (path.empty()) {
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("error: cannot allocate cartridge ram");
+    }
+    data_ = static_cast<u8 *>(data);
+    size_ = size;
+    return;
+  }
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("error: cannot open save file");
+  }
+
+  // grow shorter saves, new bytes read as zero, and map longer ones whole
+  // so that nothing past the ram is lost
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("error: cannot open save file");
+  }
+  if (static_cast<size_t>(st.st_size) > size) {
+    size = st.st_size;
+  } else if (static_cast<size_t>(st.st_size) < size &&
+             ftruncate(fd, size) != 0) {
+    close(fd);
+    throw std::runtime_error("error: cannot resize save file");
+  }
+
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("error: cannot map save file");
+  }
+  data_ = static_cast<u8 *>(data);
+  size_ = size;
+  fd_ = fd;
+}
+
+void SaveRam::unmap() {
+  if (data_ == nullptr) {
+    return;
+  }
+
+  flush(true);
+  munmap(data_, size_);
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  fd_ = -1;
+}
+
+void SaveRam::flush(bool wait) {
+  if (fd_ >= 0) {
+    msync(data_, size_, wait ? MS_SYNC : MS_ASYNC);
+  }
+}
@@ -0,0 +1,136 @@
+/*
+ * vectorenv.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "vectorenv.hpp"
+
+using namespace gbg;
+
+VectorEnv::VectorEnv(size_t count, const Config &config)
+    : config_(config), base_(60), initial_(), emulators_(),
+      actions_(nullptr), observations_(nullptr), rewards_(nullptr), next_(0),
+      pending_(0), mutex_(), start_(), done_(), batch_(0), quit_(false),
+      workers_() {
+  base_.setCartridgePath(config_.cartridgePath);
+  base_.setSavePath(config_.savePath);
+  base_.reset(config_.model, config_.fastBoot);
+  base_.save(initial_);
+
+  for (size_t i = 0; i < count; i++) {
+    emulators_.push_back(base_.fork());
+  }
+
+  size_t threads = config_.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  }
+  threads = std::min(threads, count ? count - 1 : 0);
+  for (size_t i = 0; i < threads; i++) {
+    workers_.emplace_back(&VectorEnv::worker, this);
+  }
+}
+
+VectorEnv::~VectorEnv() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void VectorEnv::step(const u8 *actions, u8 *observations, float *rewards) {
+  actions_ = actions;
+  observations_ = observations;
+  rewards_ = rewards;
+  next_.store(0, std::memory_order_relaxed);
+  pending_.store(workers_.size(), std::memory_order_relaxed);
+
+  if (!workers_.empty()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch_++;
+  }
+  start_.notify_all();
+
+  run();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] {
+    return pending_.load(std::memory_order_acquire) == 0;
+  });
+}
+
+void VectorEnv::reset(size_t index) { emulators_.at(index)->load(initial_); }
+
+void VectorEnv::reset() {
+  for (size_t i = 0; i < emulators_.size(); i++) {
+    reset(i);
+  }
+}
+
+size_t VectorEnv::size() const { return emulators_.size(); }
+
+Emulator &VectorEnv::emulator(size_t index) { return *emulators_.at(index); }
+
+void VectorEnv::worker() {
+  u64 batch = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [this, batch] { return quit_ || batch_ != batch; });
+      if (quit_) {
+        return;
+      }
+      batch = batch_;
+    }
+
+    run();
+
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.notify_one();
+    }
+  }
+}
+
+void VectorEnv::run() {
+  // instances are handed out one at a time, their cost varies with the code
+  // each one is running
+  size_t count = emulators_.size();
+  for (size_t i = next_.fetch_add(1, std::memory_order_relaxed); i < count;
+       i = next_.fetch_add(1, std::memory_order_relaxed)) {
+    stepOne(i);
+  }
+}
+
+void VectorEnv::stepOne(size_t index) {
+  Emulator &emulator = *emulators_[index];
+  MMUImpl &mmu = emulator.getMMU();
+
+  float reward = 0;
+  for (auto &term : config_.rewards) {
+    reward -= term.scale * mmu.load(term.addr);
+  }
+
+  u8 *observation =
+      observations_ ? observations_ + index * kObservationSize : nullptr;
+  emulator.setShadeOutput(observation);
+  emulator.setButtons(actions_ ? actions_[index] : 0);
+
+  for (u32 frame = 1; frame <= config_.frameSkip; frame++) {
+    emulator.setRendering(observation && frame == config_.frameSkip);
+    emulator.runUntilFrame();
+  }
+
+  for (auto &term : config_.rewards) {
+    reward += term.scale * mmu.load(term.addr);
+  }
+  if (rewards_) {
+    rewards_[index] = reward;
+  }
+}
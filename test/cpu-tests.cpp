@@ -73,4 +73,59 @@ TEST_CASE("OPCODE 02: LD (BC),A", kTag) {
   REQUIRE(cpu.regs.hl == r.hl);
   REQUIRE(ticks == 8);
   REQUIRE(mmu.read(0xc000) == 0x99);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Fetch follows boot rom unmap", kTag) {
+  MMUImpl mmu;
+  Cpu cpu(mmu);
+
+  buffer_t bios(kBiosSize, 0);
+  bios.at(0) = 0x3e; // LD A,1
+  bios.at(1) = 0x01;
+  bios.at(2) = 0xe0; // LDH (0x50),A
+  bios.at(3) = 0x50;
+  mmu.loadBios(bios);
+
+  buffer_t rom(0x8000, 0);
+  rom.at(4) = 0x06; // LD B,0x77
+  rom.at(5) = 0x77;
+  mmu.loadCartridge(rom);
+
+  cpu.cycle();
+  cpu.cycle();
+  REQUIRE(cpu.regs.pc == 0x0004);
+  cpu.cycle();
+  REQUIRE(cpu.regs.pc == 0x0006);
+  REQUIRE(cpu.regs.b == 0x77);
+}
+
+TEST_CASE("Breakpoint stops before fetch", kTag) {
+  MMUImpl mmu;
+  Cpu cpu(mmu);
+
+  buffer_t bios(kBiosSize, 0);
+  bios.at(4) = 0x01; // LD BC,d16
+  bios.at(5) = 0xcd;
+  bios.at(6) = 0xab;
+  mmu.loadBios(bios);
+
+  REQUIRE(cpu.addBreakpoint(0x0003));
+  REQUIRE(cpu.addBreakpoint(0x0006));
+  REQUIRE_FALSE(cpu.addBreakpoint(0x0003));
+
+  REQUIRE(cpu.cycle() == 4);
+  REQUIRE(cpu.cycle() == 4);
+  REQUIRE(cpu.cycle() == 4);
+  REQUIRE(cpu.regs.pc == 0x0003);
+  REQUIRE(cpu.cycle() == 0);
+  REQUIRE(cpu.stopped());
+  REQUIRE(cpu.regs.pc == 0x0003);
+
+  REQUIRE(cpu.cycle() == 4);
+  REQUIRE_FALSE(cpu.stopped());
+  REQUIRE(cpu.cycle() == 12);
+  REQUIRE(cpu.regs.bc == 0xabcd);
+
+  REQUIRE(cpu.removeBreakpoint(0x0003));
+  REQUIRE_FALSE(cpu.removeBreakpoint(0x0003));
+}
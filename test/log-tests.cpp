@@ -0,0 +1,61 @@
+/*
+ * log-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "log.hpp"
+
+#include <thread>
+#include <vector>
+
+using namespace gbg;
+
+TEST_CASE("Log formats messages in order", "[Log]") {
+  std::string line;
+  while (Log::pop(line)) {
+  }
+
+  Log::write(kLogInfo, kLogDma, 42, "from {x} to {}", 0xc100, "oam");
+  Log::write(kLogError, kLogApp, 7, "{} {}", -3, 1.5);
+
+  Log::setMask(kLogApp);
+  GBG_LOG(kLogError, kLogDma, 8, "masked");
+  GBG_LOG(kLogError, kLogApp, 9, "kept");
+  Log::setMask(0xffffffff);
+
+  REQUIRE(Log::pop(line));
+  REQUIRE(line == "[          42] info dma: from c100 to oam");
+  REQUIRE(Log::pop(line));
+  REQUIRE(line == "[           7] error app: -3 1.5");
+  REQUIRE(Log::pop(line));
+  REQUIRE(line == "[           9] error app: kept");
+  REQUIRE_FALSE(Log::pop(line));
+}
+
+TEST_CASE("Log drops messages when full", "[Log]") {
+  std::string line;
+  while (Log::pop(line)) {
+  }
+
+  std::vector<std::thread> writers;
+  for (int i = 0; i < 4; i++) {
+    writers.emplace_back([i] {
+      for (int j = 0; j < 1000; j++) {
+        Log::write(kLogInfo, kLogApp, j, "{}", i);
+      }
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+
+  u64 popped = 0;
+  while (Log::pop(line)) {
+    popped++;
+  }
+  REQUIRE(popped + Log::dropped() >= 4000);
+  REQUIRE(popped <= 1024);
+}
@@ -7,6 +7,11 @@
 
 #include "catch2/catch.hpp"
 #include "mmuimpl.hpp"
+#include "interrupt.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 
 using namespace gbg;
 
@@ -23,4 +28,440 @@ TEST_CASE("Echo store/load", "[MMUImpl]") {
   MMUImpl mmu;
   mmu.write(0xe000, 100);
   REQUIRE(mmu.read(0xc000) == 100);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Zero page store/load", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.zwrite(0x80, 42);
+  REQUIRE(mmu.read(0xff80) == 42);
+  REQUIRE(mmu.zread(0x80) == 42);
+
+  mmu.write(0xff42, 7);
+  REQUIRE(mmu.zread(0x42) == 7);
+
+  mmu.zwrite(0x04, 99);
+  REQUIRE(mmu.read(0xff04) == 0);
+}
+
+TEST_CASE("Stack push/pop", "[MMUImpl]") {
+  MMUImpl mmu;
+
+  for (addr_t top : {0xdffe, 0xe000, 0xfffe, 0xff81, 0x8010}) {
+    addr_t sp = top;
+    mmu.push(sp, 0xbeef);
+    mmu.push(sp, 0x1234);
+    REQUIRE(sp == static_cast<addr_t>(top - 4));
+    REQUIRE(mmu.read(top) == 0xef);
+    REQUIRE(mmu.read(top - 1) == 0xbe);
+    REQUIRE(mmu.pop(sp) == 0x1234);
+    REQUIRE(mmu.pop(sp) == 0xbeef);
+    REQUIRE(sp == top);
+  }
+}
+
+TEST_CASE("Stack pop leaves pages shared and clean", "[MMUImpl]") {
+  MMUImpl parent;
+  addr_t sp = 0xd010;
+  parent.push(sp, 0xbeef);
+
+  MMUImpl child;
+  parent.fork(child);
+  MMUImpl::PageSet pages;
+  u32 since = child.dirtyPages(0, pages);
+
+  REQUIRE(child.pop(sp) == 0xbeef);
+  REQUIRE(child.sharedPages() == 64);
+  child.dirtyPages(since, pages);
+  REQUIRE(pages.none());
+
+  child.push(sp, 0x1234);
+  REQUIRE(child.sharedPages() == 63);
+  child.dirtyPages(since, pages);
+  REQUIRE(pages.count() == 1);
+  REQUIRE(pages[0xd0]);
+}
+
+TEST_CASE("Watchpoint traps cpu access only", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.addWatchpoint(0xc010, kWatchWrite);
+
+  mmu.write(0xc011, 1);
+  REQUIRE_FALSE(mmu.trapped());
+  REQUIRE(mmu.read(0xc010) == 0xff);
+  REQUIRE_FALSE(mmu.trapped());
+  mmu.store(0xc010, 2);
+  REQUIRE_FALSE(mmu.trapped());
+
+  mmu.write(0xc010, 3);
+  REQUIRE(mmu.trapped());
+  REQUIRE(mmu.watchHit().addr == 0xc010);
+  REQUIRE(mmu.watchHit().value == 3);
+  mmu.clearTrap();
+
+  addr_t sp = 0xc011;
+  mmu.push(sp, 0x1234);
+  REQUIRE(mmu.trapped());
+  mmu.clearTrap();
+
+  REQUIRE(mmu.removeWatchpoint(0xc010));
+  mmu.write(0xc010, 4);
+  REQUIRE_FALSE(mmu.trapped());
+}
+
+TEST_CASE("Watchpoint on every address of a page", "[MMUImpl]") {
+  MMUImpl mmu;
+  for (addr_t addr = 0xc000; addr < 0xc100; addr++) {
+    mmu.addWatchpoint(addr, kWatchWrite);
+  }
+  mmu.write(0xc080, 1);
+  REQUIRE(mmu.trapped());
+  mmu.clearTrap();
+
+  // the page is back at full speed only once the last one is removed
+  for (addr_t addr = 0xc000; addr < 0xc0ff; addr++) {
+    REQUIRE(mmu.removeWatchpoint(addr));
+  }
+  mmu.write(0xc080, 2);
+  REQUIRE_FALSE(mmu.trapped());
+  mmu.write(0xc0ff, 3);
+  REQUIRE(mmu.trapped());
+}
+
+TEST_CASE("State save/restore", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.write(0xc000, 1);
+  mmu.write(0x8000, 2);
+  mmu.write(0xff80, 3);
+
+  MMUImpl::State state;
+  mmu.save(state);
+  auto generation = mmu.generation();
+
+  mmu.write(0xc000, 4);
+  mmu.write(0x8000, 5);
+  mmu.write(0xff80, 6);
+
+  mmu.restore(state);
+  REQUIRE(mmu.generation() != generation);
+  REQUIRE(mmu.read(0xc000) == 1);
+  REQUIRE(mmu.read(0x8000) == 2);
+  REQUIRE(mmu.read(0xff80) == 3);
+}
+
+TEST_CASE("Fork shares ram until written", "[MMUImpl]") {
+  MMUImpl parent;
+  parent.write(0xc000, 1);
+  parent.write(0x8000, 2);
+  parent.write(0xff80, 3);
+
+  MMUImpl child;
+  parent.fork(child);
+  REQUIRE(child.read(0xc000) == 1);
+  REQUIRE(child.read(0x8000) == 2);
+  REQUIRE(child.read(0xff80) == 3);
+  // every video and low ram page
+  REQUIRE(child.sharedPages() == 64);
+  REQUIRE(parent.sharedPages() == 64);
+
+  auto shared = child.sharedPages();
+  auto generation = child.generation();
+  child.write(0xc000, 4);
+  REQUIRE(child.sharedPages() == shared - 1);
+  REQUIRE(child.generation() != generation);
+  REQUIRE(child.read(0xc000) == 4);
+  REQUIRE(parent.read(0xc000) == 1);
+
+  parent.write(0x8000, 5);
+  REQUIRE(parent.read(0x8000) == 5);
+  REQUIRE(child.read(0x8000) == 2);
+  REQUIRE(child.read(0xe000) == 4);
+
+  // a fork of a fork keeps the pages it was forked with
+  MMUImpl grandchild;
+  child.fork(grandchild);
+  child.write(0xc000, 6);
+  child.write(0xc100, 7);
+  REQUIRE(grandchild.read(0xc000) == 4);
+  REQUIRE(grandchild.read(0xc100) == 0xff);
+  REQUIRE(grandchild.read(0x8000) == 2);
+}
+
+TEST_CASE("Joypad reads selected buttons", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.setButtons(kButtonRight | kButtonA | kButtonStart);
+
+  mmu.write(0xff00, 0x20); // directions
+  REQUIRE(mmu.read(0xff00) == 0xee);
+
+  mmu.write(0xff00, 0x10); // buttons
+  REQUIRE(mmu.read(0xff00) == 0xd6);
+
+  mmu.write(0xff00, 0x30);
+  REQUIRE(mmu.read(0xff00) == 0xff);
+}
+
+TEST_CASE("Joypad interrupt on selected line going low", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.write(0xff00, 0x20); // directions
+
+  mmu.setButtons(kButtonA);
+  REQUIRE((mmu.read(0xff0f) & kJoypadReleaseInterrupt) == 0);
+
+  mmu.setButtons(kButtonA | kButtonDown);
+  REQUIRE((mmu.read(0xff0f) & kJoypadReleaseInterrupt) != 0);
+
+  mmu.write(0xff0f, 0);
+  mmu.write(0xff00, 0x10); // buttons, A already held
+  REQUIRE((mmu.read(0xff0f) & kJoypadReleaseInterrupt) != 0);
+}
+
+namespace {
+struct Port {
+  u8 written = 0;
+  u8 readIo(u8 index) { return index; }
+  void writeIo(u8 index, u8 value) { written = index ^ value; }
+};
+} // namespace
+
+TEST_CASE("Io handlers receive register accesses", "[MMUImpl]") {
+  MMUImpl mmu;
+  Port port;
+  auto handler = MMUImpl::ioHandler<Port, &Port::readIo, &Port::writeIo>(&port);
+  mmu.setIoHandler(0x10, handler);
+  mmu.setIoHandler(MMUImpl::kIoInterruptSwitch, handler);
+
+  REQUIRE(mmu.read(0xff10) == 0x10);
+  REQUIRE(mmu.zread(0xff) == 0x80);
+
+  mmu.zwrite(0x10, 0x11);
+  REQUIRE(port.written == 0x01);
+  mmu.write(0xffff, 0x81);
+  REQUIRE(port.written == 0x01);
+  REQUIRE(mmu.io(MMUImpl::kIoInterruptSwitch) == 0xff);
+
+  // other registers keep plain storage
+  mmu.write(0xff11, 0x42);
+  REQUIRE(mmu.io(0x11) == 0x42);
+}
+
+TEST_CASE("Timer counts from the system counter", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.step(256 * 3 + 8);
+  REQUIRE(mmu.read(0xff04) == 3);
+
+  mmu.write(0xff04, 0);
+  mmu.write(0xff06, 0xf0); // TMA
+  mmu.write(0xff05, 0xfe); // TIMA
+  mmu.write(0xff07, 0x05); // enabled, every 16 cycles
+  mmu.step(16);
+  REQUIRE(mmu.read(0xff05) == 0xff);
+  REQUIRE((mmu.read(0xff0f) & kTimerOverflowInterrupt) == 0);
+
+  mmu.step(16);
+  REQUIRE(mmu.read(0xff05) == 0xf0);
+  REQUIRE((mmu.read(0xff0f) & kTimerOverflowInterrupt) != 0);
+
+  // resetting DIV with the watched bit set is an extra edge
+  mmu.step(8);
+  mmu.write(0xff04, 0);
+  REQUIRE(mmu.read(0xff05) == 0xf1);
+  REQUIRE(mmu.read(0xff04) == 0);
+}
+
+TEST_CASE("Timer overflows more than once in a step", "[MMUImpl]") {
+  MMUImpl mmu;
+  mmu.write(0xff06, 0xfe); // TMA
+  mmu.write(0xff05, 0xff); // TIMA
+  mmu.write(0xff07, 0x05); // enabled, every 16 cycles
+
+  // overflows at 16 and 48, counts once since the last reload
+  mmu.step(16 * 4);
+  REQUIRE(mmu.read(0xff05) == 0xff);
+  REQUIRE((mmu.read(0xff0f) & kTimerOverflowInterrupt) != 0);
+}
+
+TEST_CASE("Oam dma copies a page and keeps oam busy", "[MMUImpl]") {
+  MMUImpl mmu;
+  for (addr_t i = 0; i < 0xa0; i++) {
+    mmu.write(0xc100 + i, i);
+  }
+
+  mmu.write(0xff46, 0xc1);
+  REQUIRE(mmu.getOAM()[0x10] == 0x10);
+  REQUIRE(mmu.read(0xfe10) == 0xff);
+  mmu.write(0xfe10, 0);
+
+  mmu.step(640);
+  REQUIRE(mmu.read(0xfe10) == 0x10);
+  REQUIRE(mmu.read(0xfe9f) == 0x9f);
+}
+
+TEST_CASE("Dirty pages are tracked per consumer", "[MMUImpl]") {
+  MMUImpl mmu;
+  MMUImpl::PageSet pages;
+
+  u32 first = mmu.dirtyPages(0, pages);
+  REQUIRE(pages.all());
+  u32 second = mmu.dirtyPages(0, pages);
+
+  first = mmu.dirtyPages(first, pages);
+  REQUIRE(pages.none());
+
+  mmu.write(0xc012, 1);
+  mmu.write(0xe113, 2); // echo of 0xc113
+  mmu.write(0xc014, 3);
+  mmu.write(0xff80, 4);
+  first = mmu.dirtyPages(first, pages);
+  REQUIRE(pages.count() == 3);
+  REQUIRE(pages[0xc0]);
+  REQUIRE(pages[0xc1]);
+  REQUIRE(pages[0xff]);
+
+  // written again after the first consumer looked
+  mmu.write(0xc020, 5);
+  mmu.dirtyPages(first, pages);
+  REQUIRE(pages.count() == 1);
+
+  // second consumer still sees everything since its own look
+  mmu.dirtyPages(second, pages);
+  REQUIRE(pages.count() == 3);
+}
+
+TEST_CASE("Cartridge ram banks persist in the save file", "[MMUImpl]") {
+  // mbc1+ram+battery, 4 rom banks, 32KB of ram
+  buffer_t rom(0x10000, 0);
+  rom[0x0147] = 0x03;
+  rom[0x0149] = 0x03;
+  for (size_t bank = 0; bank < 4; bank++) {
+    rom[bank * 0x4000] = bank;
+  }
+  const char *path = "mmuimpl-tests.sav";
+  std::remove(path);
+
+  {
+    MMUImpl mmu;
+    mmu.loadCartridge(rom, path);
+
+    mmu.write(0x2000, 2);
+    REQUIRE(mmu.read(0x4000) == 2);
+
+    // disabled ram is open bus
+    mmu.write(0xa000, 0x12);
+    REQUIRE(mmu.read(0xa000) == 0xff);
+
+    mmu.write(0x0000, 0x0a);
+    mmu.write(0x6000, 0x01);
+    mmu.write(0xa000, 0x12);
+    mmu.write(0x4000, 0x03);
+    mmu.write(0xbfff, 0x34);
+    REQUIRE(mmu.read(0xa000) != 0x12);
+
+    mmu.write(0x4000, 0x00);
+    REQUIRE(mmu.read(0xa000) == 0x12);
+
+    // the save file is not shared, writes of forks stay out of it
+    MMUImpl child;
+    mmu.fork(child);
+    child.write(0xa000, 0x56);
+    REQUIRE(child.read(0xa000) == 0x56);
+    REQUIRE(mmu.read(0xa000) == 0x12);
+  }
+
+  auto load = [path] {
+    std::ifstream file(path, std::ios::binary);
+    return buffer_t((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  };
+  buffer_t saved = load();
+  REQUIRE(saved.size() == 0x8000);
+  REQUIRE(saved[0x0000] == 0x12);
+  REQUIRE(saved[0x7fff] == 0x34);
+
+  // a cartridge with less ram leaves the rest of the file alone
+  rom[0x0149] = 0x02;
+  {
+    MMUImpl mmu;
+    mmu.loadCartridge(rom, path);
+    mmu.write(0x0000, 0x0a);
+    REQUIRE(mmu.read(0xa000) == 0x12);
+  }
+  REQUIRE(load() == saved);
+  std::remove(path);
+}
+
+TEST_CASE("Fork shares cartridge ram until written", "[MMUImpl]") {
+  // mbc1+ram, 8KB of ram
+  buffer_t rom(0x8000, 0);
+  rom[0x0147] = 0x02;
+  rom[0x0149] = 0x02;
+
+  MMUImpl parent;
+  parent.loadCartridge(rom);
+  REQUIRE(parent.cartridgeRamSize() == 0x2000);
+  parent.write(0x0000, 0x0a);
+  parent.write(0xa000, 1);
+  parent.write(0xbf00, 2);
+
+  MMUImpl child;
+  parent.fork(child);
+  REQUIRE(child.read(0xa000) == 1);
+  REQUIRE(child.read(0xbf00) == 2);
+
+  child.write(0xa000, 3);
+  parent.write(0xbf00, 4);
+  REQUIRE(child.read(0xa000) == 3);
+  REQUIRE(child.read(0xbf00) == 2);
+  REQUIRE(parent.read(0xa000) == 1);
+  REQUIRE(parent.read(0xbf00) == 4);
+
+  // cartridge ram is saved apart, sized by the cartridge
+  MMUImpl::State state;
+  buffer_t cram(child.cartridgeRamSize());
+  child.save(state, cram.data());
+  REQUIRE(cram[0x0000] == 3);
+  REQUIRE(cram[0x1f00] == 2);
+
+  parent.restore(state, cram.data());
+  REQUIRE(parent.read(0xa000) == 3);
+  REQUIRE(parent.read(0xbf00) == 2);
+  REQUIRE(child.read(0xbf00) == 2);
+}
+
+TEST_CASE("Mbc3 clock counts emulated time when latched", "[MMUImpl]") {
+  // mbc3+timer+ram+battery
+  buffer_t rom(0x8000, 0);
+  rom[0x0147] = 0x10;
+  rom[0x0149] = 0x03;
+
+  MMUImpl mmu;
+  mmu.loadCartridge(rom);
+  mmu.write(0x0000, 0x0a);
+
+  auto latch = [&mmu] {
+    mmu.write(0x6000, 0x00);
+    mmu.write(0x6000, 0x01);
+  };
+
+  mmu.step(kClockRate * (24 * 60 * 60 + 61));
+  mmu.write(0x4000, 0x08);
+  REQUIRE(mmu.read(0xa000) == 0);
+  latch();
+  REQUIRE(mmu.read(0xa000) == 1);
+  mmu.write(0x4000, 0x09);
+  REQUIRE(mmu.read(0xa000) == 1);
+  mmu.write(0x4000, 0x0b);
+  REQUIRE(mmu.read(0xa000) == 1);
+
+  // halted clock keeps its value
+  mmu.write(0x4000, 0x0c);
+  mmu.write(0xa000, 0x40);
+  mmu.step(kClockRate * 5);
+  latch();
+  mmu.write(0x4000, 0x08);
+  REQUIRE(mmu.read(0xa000) == 1);
+
+  // ram banks are back once selected
+  mmu.write(0x4000, 0x00);
+  mmu.write(0xa000, 0x55);
+  REQUIRE(mmu.read(0xa000) == 0x55);
+}
@@ -0,0 +1,118 @@
+/*
+ * movie-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "emulator.hpp"
+#include "movie.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+using namespace gbg;
+
+// Mbc1 cartridge with 8KB of ram that keeps storing the buttons into it,
+// and into the first byte of tile 0 so that they show on screen
+static buffer_t joypadLogger() {
+  buffer_t rom(0x8000, 0);
+  rom[0x0147] = 0x02;
+  rom[0x0149] = 0x02;
+
+  const u8 code[] = {
+      0x3e, 0x0a,       // ld a, 0x0a
+      0xea, 0x00, 0x00, // ld (0x0000), a   ; enable ram
+      0x21, 0x00, 0xa0, // ld hl, 0xa000
+      0x3e, 0x10,       // ld a, 0x10       ; select buttons
+      0xe0, 0x00,       // ldh (0x00), a
+      0xf0, 0x00,       // ldh a, (0x00)
+      0x22,             // ld (hl+), a
+      0xea, 0x00, 0x80, // ld (0x8000), a
+      0x7c,             // ld a, h
+      0xfe, 0xc0,       // cp 0xc0
+      0x20, 0xf1,       // jr nz, -15       ; to select buttons
+      0x18, 0xec,       // jr -20           ; to ld hl
+  };
+  std::copy(std::begin(code), std::end(code), rom.begin() + 0x0100);
+  return rom;
+}
+
+TEST_CASE("Movie seek and playback reproduce the recording", "[Movie]") {
+  Emulator emulator(60);
+  emulator.getMMU().loadCartridge(joypadLogger());
+  emulator.getMMU().skipBios(Model::DMG);
+  emulator.getRegisters().pc = 0x0100;
+
+  const u32 kFrames = 40;
+  std::mt19937 rng(42);
+  std::vector<buffer_t> states(kFrames + 1);
+  std::vector<buffer_t> screens(kFrames + 1);
+
+  Movie movie;
+  movie.record(emulator, 8);
+  for (u32 i = 0; i < kFrames; i++) {
+    emulator.save(states[i]);
+    screens[i] = emulator.screen();
+    movie.recordFrame(emulator, rng() & 0xff);
+  }
+  emulator.save(states[kFrames]);
+  screens[kFrames] = emulator.screen();
+  // cartridge ram follows the state
+  REQUIRE(states[kFrames].size() == sizeof(Emulator::State) + 0x2000);
+
+  const char *path = "movie-tests.gbm";
+  movie.save(path);
+  Movie loaded;
+  loaded.load(path);
+  std::remove(path);
+  REQUIRE(loaded.frames() == kFrames);
+
+  buffer_t state;
+  for (u32 frame : {0u, 1u, 7u, 8u, 9u, 23u, 24u, 16u, kFrames}) {
+    loaded.seek(emulator, frame);
+    REQUIRE(loaded.frame() == frame);
+    emulator.save(state);
+    REQUIRE(state == states[frame]);
+    // the whole screen of the frame, keyframes included
+    if (frame >= emulator.renderFrames()) {
+      REQUIRE(emulator.screen() == screens[frame]);
+    }
+  }
+
+  loaded.seek(emulator, 5);
+  while (loaded.playFrame(emulator)) {
+    emulator.save(state);
+    REQUIRE(state == states[loaded.frame()]);
+  }
+  REQUIRE(loaded.frame() == kFrames);
+}
+
+TEST_CASE("Movie load rejects sizes past the end of the file", "[Movie]") {
+  Emulator emulator(60);
+  emulator.getMMU().loadCartridge(joypadLogger());
+  Movie movie;
+  movie.record(emulator);
+  movie.recordFrame(emulator, 0);
+
+  const char *path = "movie-tests.gbm";
+  movie.save(path);
+  std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+  buffer_t header(40);
+  file.read(reinterpret_cast<char *>(header.data()), header.size());
+
+  // frames, then keyframes, claimed by the header
+  for (size_t offset : {28, 32}) {
+    buffer_t corrupt = header;
+    std::fill(corrupt.begin() + offset, corrupt.begin() + offset + 4, 0xff);
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(corrupt.data()), corrupt.size());
+    file.flush();
+
+    Movie loaded;
+    REQUIRE_THROWS_AS(loaded.load(path), std::runtime_error);
+  }
+  std::remove(path);
+}
@@ -0,0 +1,145 @@
+/*
+ * rewind-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "emulator.hpp"
+#include "rewind.hpp"
+
+#include <random>
+
+using namespace gbg;
+
+static void roundTrip(const buffer_t &a, const buffer_t &b, buffer_t &out) {
+  Rewind::encode(a.data(), b.data(), a.size(), out);
+  buffer_t decoded = b;
+  Rewind::decode(out.data(), out.size(), decoded.data());
+  REQUIRE(decoded == a);
+}
+
+TEST_CASE("Rewind encoding round trips", "[Rewind]") {
+  // longer than a few runs of 0xffff bytes
+  const size_t kSize = 0x30000;
+  std::mt19937 rng(42);
+  buffer_t a(kSize);
+  for (auto &byte : a) {
+    byte = rng();
+  }
+  buffer_t b = a;
+  buffer_t out;
+
+  SECTION("empty") {
+    roundTrip(buffer_t(), buffer_t(), out);
+    REQUIRE(out.empty());
+  }
+
+  SECTION("equal") {
+    roundTrip(a, b, out);
+    // one run per 0xffff equal bytes, no literals
+    REQUIRE(out.size() == 4 * 4);
+  }
+
+  SECTION("every byte differs") {
+    for (auto &byte : b) {
+      byte = ~byte;
+    }
+    roundTrip(a, b, out);
+  }
+
+  SECTION("literal run rolled back to the largest run") {
+    // literals grow 4 bytes at a time over three equal ones, going past
+    // the largest run
+    for (size_t i = 3; i < kSize; i += 4) {
+      b[i] = ~b[i];
+    }
+    roundTrip(a, b, out);
+  }
+
+  SECTION("trailing equal bytes") {
+    for (size_t tail : {1, 2, 3, 4, 5, 100}) {
+      b = a;
+      for (size_t i = 0; i < kSize - tail; i += 2) {
+        b[i] = ~b[i];
+      }
+      roundTrip(a, b, out);
+    }
+  }
+
+  SECTION("random") {
+    for (int n = 0; n < 64; n++) {
+      size_t size = rng() % kSize;
+      buffer_t x(a.begin(), a.begin() + size);
+      buffer_t y = x;
+      size_t changes = size ? rng() % size : 0;
+      for (size_t i = 0; i < changes; i++) {
+        y[rng() % size] = rng();
+      }
+      roundTrip(x, y, out);
+    }
+  }
+}
+
+// Fills a page of low ram with a pattern of its own every call
+static void scribble(Emulator &emulator, size_t n) {
+  addr_t page = MemAddr::kLowRAM + (n % 0x20) * 0x100;
+  for (size_t i = 0; i < 0x100; i++) {
+    emulator.getMMU().write(page + i, n + i);
+  }
+}
+
+TEST_CASE("Rewind ring wraps and evicts the oldest captures", "[Rewind]") {
+  Emulator emulator(60);
+  emulator.getMMU().loadCartridge(buffer_t(0x8000, 0));
+  Rewind rewind(4096, 1);
+
+  std::vector<buffer_t> states(64);
+  for (size_t i = 0; i < states.size(); i++) {
+    scribble(emulator, i);
+    rewind.capture(emulator);
+    emulator.save(states[i]);
+    REQUIRE(rewind.used() <= rewind.capacity());
+  }
+
+  // history is bounded by the ring, not by the captures
+  u64 frames = rewind.frames();
+  REQUIRE(frames > 0);
+  REQUIRE(frames < states.size() - 1);
+
+  buffer_t state;
+  for (u64 i = 1; i <= frames; i++) {
+    REQUIRE(rewind.step(emulator));
+    emulator.save(state);
+    REQUIRE(state == states[states.size() - 1 - i]);
+  }
+
+  // the oldest capture left is kept whole
+  REQUIRE_FALSE(rewind.step(emulator));
+  emulator.save(state);
+  REQUIRE(state == states[states.size() - 1 - frames]);
+  REQUIRE(rewind.used() == 0);
+}
+
+TEST_CASE("Rewind drops history a capture does not fit", "[Rewind]") {
+  Emulator emulator(60);
+  emulator.getMMU().loadCartridge(buffer_t(0x8000, 0));
+  Rewind rewind(64, 1);
+
+  scribble(emulator, 0);
+  rewind.capture(emulator);
+  scribble(emulator, 1);
+  rewind.capture(emulator);
+  REQUIRE(rewind.frames() == 0);
+  REQUIRE(rewind.used() == 0);
+
+  buffer_t expected;
+  emulator.save(expected);
+  scribble(emulator, 2);
+  REQUIRE_FALSE(rewind.step(emulator));
+
+  buffer_t state;
+  emulator.save(state);
+  REQUIRE(state == expected);
+}
@@ -0,0 +1,123 @@
+/*
+ * runahead-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "runahead.hpp"
+
+#include <random>
+
+using namespace gbg;
+
+// Cartridge that keeps storing the buttons into tile 0, which fills the
+// background
+static void boot(Emulator &emulator) {
+  buffer_t rom(0x8000, 0);
+  const u8 code[] = {
+      0x21, 0x00, 0x80, // ld hl, 0x8000
+      0x3e, 0x10,       // ld a, 0x10       ; select buttons
+      0xe0, 0x00,       // ldh (0x00), a
+      0xf0, 0x00,       // ldh a, (0x00)
+      0x22,             // ld (hl+), a
+      0x7d,             // ld a, l
+      0xfe, 0x10,       // cp 0x10
+      0x20, 0xf4,       // jr nz, -12       ; to select buttons
+      0x18, 0xef,       // jr -17           ; to ld hl
+  };
+  std::copy(std::begin(code), std::end(code), rom.begin() + 0x0100);
+
+  emulator.getMMU().loadCartridge(rom);
+  emulator.getMMU().skipBios(Model::DMG);
+  emulator.getRegisters().pc = 0x0100;
+}
+
+// Buttons held for a few frames at a time
+static u8 buttons(u32 frame) {
+  static const u8 kButtons[] = {0x00, 0x10, 0xa0, 0x40, 0x80, 0x30};
+  return kButtons[(frame / 8) % sizeof(kButtons)];
+}
+
+TEST_CASE("RunAhead shows the frame ahead and keeps the real timeline",
+          "[RunAhead]") {
+  const u32 kFrames = 48;
+  const u32 kAhead = 4;
+
+  // every frame rendered, no run-ahead
+  Emulator direct(60);
+  boot(direct);
+  std::vector<buffer_t> states(kFrames + kAhead + 1);
+  std::vector<buffer_t> screens(kFrames + kAhead + 1);
+  direct.save(states[0]);
+  for (u32 i = 0; i < kFrames + kAhead; i++) {
+    direct.setButtons(buttons(i));
+    direct.nextFrame();
+    direct.save(states[i + 1]);
+    screens[i + 1] = direct.screen();
+  }
+
+  for (u8 frames = 1; frames <= kAhead; frames++) {
+    Emulator emulator(60);
+    boot(emulator);
+    RunAhead runAhead(frames);
+    buffer_t state;
+
+    for (u32 i = 0; i < kFrames; i++) {
+      emulator.setButtons(buttons(i));
+      runAhead.nextFrame(emulator);
+      emulator.save(state);
+      REQUIRE(state == states[i + 1]);
+
+      // frames ahead run with the buttons of the real one, the screen
+      // shown is whole when the frames rendered cover it
+      if (buttons(i) == buttons(i + frames) &&
+          frames + 1u >= emulator.renderFrames()) {
+        REQUIRE(emulator.screen() == screens[i + 1 + frames]);
+      }
+    }
+  }
+}
+
+TEST_CASE("RunAhead keeps joypad events for the real timeline",
+          "[RunAhead]") {
+  const u32 kFrames = 40;
+  const u32 kAhead = 3;
+
+  // button changes queued up front, every few scanlines
+  std::mt19937 rng(42);
+  std::vector<JoypadEvent> events;
+  for (ticks_t cycle = 1000; events.size() < Emulator::kJoypadQueueSize;
+       cycle += 5000 + rng() % 20000) {
+    events.push_back({cycle, static_cast<u8>(rng() & 0xf0)});
+  }
+  auto queue = [&events](Emulator &emulator) {
+    for (auto &event : events) {
+      REQUIRE(emulator.joypad().push(event));
+    }
+  };
+
+  Emulator direct(60);
+  boot(direct);
+  queue(direct);
+  std::vector<buffer_t> states(kFrames + kAhead + 1);
+  std::vector<buffer_t> screens(kFrames + kAhead + 1);
+  for (u32 i = 0; i < kFrames + kAhead; i++) {
+    direct.nextFrame();
+    direct.save(states[i + 1]);
+    screens[i + 1] = direct.screen();
+  }
+
+  Emulator emulator(60);
+  boot(emulator);
+  queue(emulator);
+  RunAhead runAhead(kAhead);
+  buffer_t state;
+  for (u32 i = 0; i < kFrames; i++) {
+    runAhead.nextFrame(emulator);
+    emulator.save(state);
+    REQUIRE(state == states[i + 1]);
+    REQUIRE(emulator.screen() == screens[i + 1 + kAhead]);
+  }
+}
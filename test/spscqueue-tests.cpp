@@ -0,0 +1,57 @@
+/*
+ * spscqueue-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "spscqueue.hpp"
+
+#include <thread>
+
+using namespace gbg;
+
+TEST_CASE("Queue is bounded and ordered", "[SpscQueue]") {
+  SpscQueue<int, 4> queue;
+  int value = 0;
+  REQUIRE_FALSE(queue.pop(value));
+  REQUIRE(queue.peek() == nullptr);
+
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(queue.push(i));
+  }
+  REQUIRE_FALSE(queue.push(4));
+  REQUIRE(*queue.peek() == 0);
+
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(queue.pop(value));
+    REQUIRE(value == i);
+  }
+  REQUIRE_FALSE(queue.pop(value));
+}
+
+TEST_CASE("Queue across threads", "[SpscQueue]") {
+  SpscQueue<int, 16> queue;
+  const int kItems = 100000;
+
+  std::thread producer([&queue] {
+    for (int i = 0; i < kItems; i++) {
+      while (!queue.push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  int expected = 0;
+  bool ordered = true;
+  while (expected < kItems) {
+    int value;
+    if (queue.pop(value)) {
+      ordered = ordered && (value == expected);
+      expected++;
+    }
+  }
+  producer.join();
+  REQUIRE(ordered);
+}
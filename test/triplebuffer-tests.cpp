@@ -0,0 +1,31 @@
+/*
+ * triplebuffer-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "triplebuffer.hpp"
+
+using namespace gbg;
+
+TEST_CASE("Consumer sees latest published value", "[TripleBuffer]") {
+  TripleBuffer<int> buffer;
+  REQUIRE_FALSE(buffer.update());
+
+  buffer.back() = 1;
+  buffer.publish();
+  buffer.back() = 2;
+  buffer.publish();
+
+  REQUIRE(buffer.update());
+  REQUIRE(buffer.front() == 2);
+  REQUIRE_FALSE(buffer.update());
+  REQUIRE(buffer.front() == 2);
+
+  buffer.back() = 3;
+  buffer.publish();
+  REQUIRE(buffer.update());
+  REQUIRE(buffer.front() == 3);
+}
@@ -0,0 +1,112 @@
+/*
+ * vectorenv-tests.cpp
+ * Copyright (C) 2020 Emiliano Firmino <emiliano.firmino@gmail.com>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "catch2/catch.hpp"
+#include "vectorenv.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+using namespace gbg;
+
+// Cartridge that keeps storing the buttons into tile 0, which fills the
+// background after a fast boot
+static void writeTileLogger(const char *path) {
+  buffer_t rom(0x8000, 0);
+  const u8 code[] = {
+      0x21, 0x00, 0x80, // ld hl, 0x8000
+      0x3e, 0x10,       // ld a, 0x10       ; select buttons
+      0xe0, 0x00,       // ldh (0x00), a
+      0xf0, 0x00,       // ldh a, (0x00)
+      0x22,             // ld (hl+), a
+      0x7d,             // ld a, l
+      0xfe, 0x10,       // cp 0x10
+      0x20, 0xf4,       // jr nz, -12       ; to select buttons
+      0x18, 0xef,       // jr -17           ; to ld hl
+  };
+  std::copy(std::begin(code), std::end(code), rom.begin() + 0x0100);
+
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(rom.data()), rom.size());
+}
+
+TEST_CASE("VectorEnv steps instances as they run on their own",
+          "[VectorEnv]") {
+  const char *path = "vectorenv-tests.gb";
+  writeTileLogger(path);
+
+  VectorEnv::Config config;
+  config.cartridgePath = path;
+  config.frameSkip = 2;
+  config.rewards = {{0x8000, 1.0f}, {0x800f, -0.5f}};
+  config.threads = 3;
+
+  const size_t kCount = 6;
+  const size_t kSize = VectorEnv::kObservationSize;
+  VectorEnv env(kCount, config);
+
+  std::vector<std::unique_ptr<Emulator>> alone;
+  for (size_t i = 0; i < kCount; i++) {
+    alone.emplace_back(new Emulator(60));
+    alone[i]->setCartridgePath(path);
+    alone[i]->setSavePath("");
+    alone[i]->reset(config.model, config.fastBoot);
+  }
+
+  std::mt19937 rng(42);
+  u8 actions[kCount];
+  buffer_t observations(kCount * kSize);
+  float rewards[kCount];
+  buffer_t expected(kSize);
+  buffer_t a;
+  buffer_t b;
+
+  for (int step = 0; step < 8; step++) {
+    for (auto &action : actions) {
+      action = rng();
+    }
+    env.step(actions, observations.data(), rewards);
+
+    for (size_t i = 0; i < kCount; i++) {
+      Emulator &emulator = *alone[i];
+      MMUImpl &mmu = emulator.getMMU();
+      float reward = 0;
+      for (auto &term : config.rewards) {
+        reward -= term.scale * mmu.load(term.addr);
+      }
+      emulator.setShadeOutput(expected.data());
+      emulator.setButtons(actions[i]);
+      for (u32 frame = 1; frame <= config.frameSkip; frame++) {
+        emulator.setRendering(frame == config.frameSkip);
+        emulator.runUntilFrame();
+      }
+      for (auto &term : config.rewards) {
+        reward += term.scale * mmu.load(term.addr);
+      }
+
+      REQUIRE(std::equal(expected.begin(), expected.end(),
+                         observations.begin() + i * kSize));
+      REQUIRE(rewards[i] == reward);
+      env.emulator(i).save(a);
+      emulator.save(b);
+      REQUIRE(a == b);
+    }
+  }
+
+  // instances diverged with their own input, reset brings them back to
+  // power on, a reset emulator would keep its cartridge clock running
+  Emulator fresh(60);
+  fresh.setCartridgePath(path);
+  fresh.setSavePath("");
+  fresh.reset(config.model, config.fastBoot);
+  env.reset(0);
+  env.emulator(0).save(a);
+  fresh.save(b);
+  REQUIRE(a == b);
+  std::remove(path);
+}